@@ -0,0 +1,174 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/** @file
+ * C interface of libink, for tracing in-process without files or a
+ * process per image.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef INK_CAPI_H
+#define INK_CAPI_H
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#  if defined(INK_BUILDING_LIBRARY)
+#    define INK_API __declspec(dllexport)
+#  elif defined(INK_SHARED)
+#    define INK_API __declspec(dllimport)
+#  else
+#    define INK_API
+#  endif
+#elif defined(__GNUC__)
+#  define INK_API __attribute__((visibility("default")))
+#else
+#  define INK_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped whenever a function or struct member is added. */
+#define INK_API_VERSION 5
+
+typedef struct ink_engine ink_engine;
+typedef struct ink_result ink_result;
+typedef struct ink_image ink_image;
+
+/* Same values and meaning as TraceType. Centerline tracing uses only the
+   brightness threshold, invert and threads parameters. */
+typedef enum ink_trace_type {
+  INK_TRACE_BRIGHTNESS = 0,
+  INK_TRACE_BRIGHTNESS_MULTI = 1,
+  INK_TRACE_CANNY = 2,
+  INK_TRACE_QUANT = 3,
+  INK_TRACE_QUANT_COLOR = 4,
+  INK_TRACE_QUANT_MONO = 5,
+  INK_TRACE_CENTERLINE = 8
+} ink_trace_type;
+
+/* Layout of one pixel in the caller's buffer, 8 bits per channel. Alpha is
+   composited over white, and fully transparent pixels are never traced. */
+typedef enum ink_pixel_format {
+  INK_PIXEL_RGB = 0,
+  INK_PIXEL_RGBA = 1,
+  INK_PIXEL_BGR = 2,
+  INK_PIXEL_BGRA = 3,
+  INK_PIXEL_GRAY = 4
+} ink_pixel_format;
+
+/* Engine parameters. Always fill in with ink_params_init() first: it sets
+   struct_size, which lets later versions append members without breaking
+   callers built against this one. Negative potrace values keep potrace's
+   defaults. */
+typedef struct ink_params {
+  size_t struct_size;
+
+  int trace_type;              /* ink_trace_type */
+  int invert;
+  int quantization_colors;
+  double brightness_threshold;
+  double brightness_floor;
+  double canny_threshold;
+  int multiscan_colors;
+  int multiscan_stack;
+  int multiscan_smooth;
+  int multiscan_remove_background;
+
+  int turdsize;
+  double alphamax;
+  int opticurve;
+  double opttolerance;
+
+  int threads;                 /* threads used per trace, 0: one per core */
+} ink_params;
+
+/* Version of the library actually loaded. */
+INK_API int ink_version(void);
+
+/* Message describing the last failure on the calling thread. */
+INK_API const char *ink_last_error(void);
+
+INK_API void ink_params_init(ink_params *params);
+
+/* An engine holds its parameters and may be reused for any number of
+   traces, including by several threads at once. Members past the
+   caller's struct_size take their ink_params_init() values. Returns NULL
+   for parameters out of range: color counts outside 1..256, thresholds
+   outside 0..1, non-finite potrace values or negative threads. */
+INK_API ink_engine *ink_engine_new(const ink_params *params);
+INK_API void ink_engine_free(ink_engine *engine);
+
+/* Trace a caller-owned buffer of height rows, stride bytes apart. The
+   buffer is only read during the call. Returns NULL on failure. */
+INK_API ink_result *ink_trace(ink_engine *engine, const unsigned char *pixels,
+                              int width, int height, ptrdiff_t stride,
+                              ink_pixel_format format);
+
+/* An image copied out of a caller buffer, kept for repeated previews and
+   traces. It caches reduced-resolution levels as previews ask for them,
+   and may be shared by several engines and threads. */
+INK_API ink_image *ink_image_new(const unsigned char *pixels, int width,
+                                 int height, ptrdiff_t stride,
+                                 ink_pixel_format format);
+INK_API void ink_image_free(ink_image *image);
+
+/* Trace a kept image at full resolution. */
+INK_API ink_result *ink_trace_image(ink_engine *engine, ink_image *image);
+
+/* Called with each path of a streamed trace, in the order ink_result would
+   list them. The strings are only valid during the call. */
+typedef void (*ink_item_fn)(const char *style, const char *path, void *user);
+
+/* Trace a kept image at full resolution, handing each layer's path to item
+   as soon as that layer is traced rather than collecting a result. Returns
+   0, or -1 on failure. */
+INK_API int ink_trace_stream(ink_engine *engine, ink_image *image,
+                             ink_item_fn item, void *user);
+
+/* Called with each result of a progressive trace; final is 0 for the coarse
+   result and 1 for the full resolution one. The result is owned by the
+   library and only valid during the call. */
+typedef void (*ink_progress_fn)(const ink_result *result, int final,
+                                void *user);
+
+/* Trace a kept image progressively: an image larger than coarse_pixels
+   (0: a default of 2^18) is first traced at a reduced size and passed to
+   progress scaled to full size, then traced at full resolution. Color
+   quantization keeps the palette of the coarse pass. Returns the final
+   result, as from ink_trace_image(). */
+INK_API ink_result *ink_trace_progressive(ink_engine *engine,
+                                          ink_image *image, long coarse_pixels,
+                                          ink_progress_fn progress,
+                                          void *user);
+
+/* Preview a kept image at the smallest reduced size that still holds
+   min_pixels pixels (0: full size), smaller still if earlier previews of
+   this engine suggest it would take longer than max_millis (0: no limit). On success
+   stores a packed RGB buffer, to be released with ink_free(), and its size,
+   and returns 0; returns -1 on failure. */
+INK_API int ink_preview(ink_engine *engine, ink_image *image, long min_pixels,
+                        double max_millis, unsigned char **rgb, int *width,
+                        int *height);
+
+/* Release memory handed out by the library. */
+INK_API void ink_free(void *memory);
+
+/* Result items as SVG style and path data, the last one being the
+   bottom-most. The strings live as long as the result. */
+INK_API size_t ink_result_count(const ink_result *result);
+INK_API const char *ink_result_style(const ink_result *result, size_t index);
+INK_API const char *ink_result_path(const ink_result *result, size_t index);
+
+/* The whole result as an SVG document. Lives as long as the result. */
+INK_API const char *ink_result_svg(ink_result *result);
+
+INK_API void ink_result_free(ink_result *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INK_CAPI_H */
@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Command line options of the ink binary.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef CLI_OPTIONS_H
+#define CLI_OPTIONS_H
+
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "cli/pipeline.h"
+#include "engines/engines.h"
+
+namespace Cli {
+
+// 引擎选项, 默认值即原先 main.cpp 中写死的参数
+struct EngineOptions {
+  TraceType traceType = TraceType::QUANT; // 追踪类型
+  bool invert = false;                    // 是否反转
+  int quantizationNrColors = 4;           // 量化颜色数
+  double brightnessThreshold = 0.45;      // 亮度阈值
+  double brightnessFloor = 0.0;           // 亮度地板
+  double cannyHighThreshold = 0.55;       // 边缘检测阈值
+  int multiScanNrColors = 2;              // 多扫描颜色数
+  bool multiScanStack = true;             // 多扫描堆叠
+  bool multiScanSmooth = false;           // 多扫描平滑
+  bool multiScanRemoveBackground = false; // 多扫描移除背景
+
+  std::optional<int> turdSize;        // 斑点大小
+  std::optional<double> alphaMax;     // 最大透明度
+  std::optional<bool> optiCurve;      // 优化曲线
+  std::optional<double> optTolerance; // 优化容差
+
+  QuantizeOptions quantize; // 量化选项
+  int traceThreads = 1;     // 单图追踪线程数
+  Potrace::BitmapCleanup cleanup; // 位图预处理
+};
+
+// 命令行选项
+struct CliOptions {
+  EngineOptions engine;
+  PipelineOptions pipeline;
+  std::vector<std::string> inputs; // 图像文件或目录
+  std::vector<std::string> lists;  // 清单文件 ("-" 为标准输入)
+  std::string output;              // 输出文件或目录
+  std::string serveSocket;         // 服务模式的 Unix 套接字
+  MapStorage storage;              // 大图像的存放位置
+  bool help = false;
+};
+
+/**
+ * Parse argv. On error returns nullopt and describes the problem in
+ * <error>.
+ */
+std::optional<CliOptions> parseArgs(int argc, char **argv, std::string &error);
+
+/**
+ * Expand inputs, directories and manifests into jobs. A single image with
+ * no output given keeps the old behaviour of writing output.svg; otherwise
+ * the output is a directory (default: current) receiving <stem>.svg, or
+ * <stem>.preview.ppm in preview mode. Fails if an output would overwrite
+ * one of the inputs, or two inputs would write the same output.
+ */
+std::optional<std::vector<BatchJob>> collectJobs(CliOptions const &options,
+                                                 std::string &error);
+
+// 按选项创建引擎
+std::unique_ptr<TracingEngine> makeEngine(EngineOptions const &options);
+
+// 打印用法
+void printUsage(std::FILE *out);
+
+} // namespace Cli
+
+#endif // CLI_OPTIONS_H
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Batch tracing with decode, trace and write overlapped across files.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef CLI_PIPELINE_H
+#define CLI_PIPELINE_H
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "core/core.h"
+#include "trace/trace.h"
+
+namespace Cli {
+
+// 一个批处理任务
+struct BatchJob {
+  std::string input;  // 输入图像
+  std::string output; // 输出 SVG
+};
+
+// 解码后的图像
+struct DecodedImage {
+  RgbMap rgbmap;
+  int width;
+  int height;
+};
+
+// 图像解码器 (失败返回 nullopt); 第二个参数为至少需要的像素数, 0 为原尺寸
+using ImageDecoder =
+    std::function<std::optional<DecodedImage>(std::string const &, long)>;
+// 引擎工厂: 只调用一次, 引擎由所有追踪线程共享
+using EngineFactory = std::function<std::unique_ptr<TracingEngine>()>;
+
+// 流水线选项
+struct PipelineOptions {
+  int decodeThreads = 2;  // 解码线程数
+  int traceThreads = 0;   // 追踪线程数 (0: 每核一个)
+  int writeThreads = 1;   // 写出线程数
+  int queueDepth = 4;     // 每级队列容量 (限制内存)
+  bool verbose = false;   // 逐文件报告
+  long previewPixels = 0; // >0: 输出至少这么多像素的 PPM 预览, 而非 SVG
+};
+
+// 批处理统计
+struct BatchStats {
+  int traced = 0;
+  int failed = 0;
+};
+
+/**
+ * Trace every job. Decoding, tracing and writing run on their own pools
+ * joined by bounded queues, so at most queueDepth decoded images and
+ * queueDepth traced results wait between stages at any time. Files finish
+ * in whatever order their stages allow; failures, including exceptions
+ * thrown for one file, are reported on stderr and counted.
+ * In preview mode images are decoded no larger than needed and previewed
+ * from a pyramid instead of traced.
+ */
+BatchStats runPipeline(std::vector<BatchJob> const &jobs,
+                       ImageDecoder const &decode,
+                       EngineFactory const &makeEngine,
+                       PipelineOptions const &options = {});
+
+} // namespace Cli
+
+#endif // CLI_PIPELINE_H
@@ -3,5 +3,7 @@
 
 #include "svg/svg.h"
 #include "image/imagemap.h"
+#include "image/pyramid.h"
+#include "image/mapdump.h"
 
 #endif // CORE_H
\ No newline at end of file
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Hot inner loops, built for several instruction sets and picked at run time.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef INKSCAPE_TRACE_KERNELS_H
+#define INKSCAPE_TRACE_KERNELS_H
+
+#include <cstddef>
+
+#include "core/image/imagemap.h"
+
+namespace Kernels {
+
+enum class Isa
+{
+    BASELINE, ///< What the compiler targets by default (SSE2 on x86-64).
+    AVX2,
+    AVX512,   ///< AVX-512 F and BW.
+};
+
+/// Weights of the 5x5 gaussian of the filters, row by row; they sum to 159.
+inline int constexpr GAUSS_WEIGHTS[25] = {
+    2,  4,  5,  4, 2,
+    4,  9, 12,  9, 4,
+    5, 12, 15, 12, 5,
+    4,  9, 12,  9, 4,
+    2,  4,  5,  4, 2,
+};
+
+/// Largest block gaussBlock() takes.
+int constexpr GAUSS_BLOCK = 256;
+/// Largest batch nearestColor() takes.
+int constexpr COLOR_BATCH = 64;
+
+/**
+ * One variant of every kernel. The variants are the same plain loops,
+ * compiled for wider vectors, so they give identical results.
+ */
+struct Table
+{
+    Isa isa;
+
+    /// 5x5 gaussian of <n> <= GAUSS_BLOCK samples of one channel; lines[i]
+    /// points at the first of them in source row i - 2.
+    void (*gaussBlock)(unsigned char const *const *lines, int n, unsigned char *dst);
+
+    /// Gray values (r + g + b scaled by 255/256) of <n> pixels.
+    void (*grayRow)(RGB const *src, size_t n, unsigned long *dst);
+
+    /// Index of the closest of <size> palette colors, given as separate
+    /// component arrays, for each of <n> <= COLOR_BATCH pixels. Ties go
+    /// to the lowest index.
+    void (*nearestColor)(int const *r, int const *g, int const *b, int size,
+                         RGB const *rgbs, int n, unsigned *out);
+};
+
+/**
+ * The variant for this CPU, chosen on first use: the widest it supports,
+ * or the one named by the INK_KERNELS environment variable (baseline,
+ * avx2, avx512) when the CPU has it, for benchmarking. An override that
+ * cannot be honoured is reported on stderr.
+ */
+Table const &table();
+
+char const *isaName(Isa isa);
+
+} // namespace Kernels
+
+#endif // INKSCAPE_TRACE_KERNELS_H
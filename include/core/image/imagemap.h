@@ -10,26 +10,33 @@
 #ifndef INKSCAPE_TRACE_IMAGEMAP_H
 #define INKSCAPE_TRACE_IMAGEMAP_H
 
+#include <cstddef>
 #include <vector>
 #include <array>
 
+#include "mapstorage.h"
 
 
+
+/**
+ * Pixels are stored row after row as set up by setMapStorage(). Sides fit
+ * an int, offsets and sizes are 64 bit, so images can go past 2G pixels.
+ */
 template <typename T>
 struct MapBase
 {
     int width;
     int height;
-    std::vector<T> pixels;
+    std::vector<T, MapAllocator<T>> pixels;
 
     MapBase(int width, int height)
         : width(width)
         , height(height)
-        , pixels(width * height) {}
+        , pixels((size_t)width * height) {}
 
-    int offset(int x, int y) const { return x + y * width; }
-    T       *row(int y)       { return pixels.data() + y * width; }
-    T const *row(int y) const { return pixels.data() + y * width; }
+    size_t offset(int x, int y) const { return x + (size_t)y * width; }
+    T       *row(int y)       { return pixels.data() + (size_t)y * width; }
+    T const *row(int y) const { return pixels.data() + (size_t)y * width; }
     void setPixel(int x, int y, T val) { pixels[offset(x, y)] = val; }
     T getPixel(int x, int y) const { return pixels[offset(x, y)]; }
 };
@@ -60,24 +67,100 @@ struct RGB
     unsigned char b;
 };
 
+static_assert(sizeof(RGB) == 3, "RgbMap rows are written out as packed bytes");
+
+/**
+ * Colors of translucent pixels are stored composited over white, so code
+ * that ignores alpha still sees what would be drawn.
+ */
 struct RgbMap
     : MapBase<RGB>
 {
     RgbMap(int width, int height);
 
     bool writePPM(char const *fileName);
+
+    /// Opacity of every pixel, 0 for fully transparent; empty when the
+    /// whole image is opaque.
+    std::vector<unsigned char, MapAllocator<unsigned char>> alpha;
+
+    bool hasAlpha() const { return !alpha.empty(); }
+    bool isTransparent(int x, int y) const { return !alpha.empty() && alpha[offset(x, y)] == 0; }
+};
+
+/// Bounds [x0, x1) x [y0, y1) of a region of an image.
+struct PixelBox
+{
+    int x0, y0, x1, y1;
+
+    bool empty() const { return x1 <= x0 || y1 <= y0; }
+};
+
+/*
+ * GrayTiles
+ */
+
+/**
+ * Coarse occupancy index of a GrayMap: the lowest and highest value in
+ * every TILE x TILE block, so that work on blocks holding a single value
+ * can be skipped. With a halo, the range of a block also covers that many
+ * pixels around it, which is what a filter of that radius reads.
+ */
+struct GrayTiles
+{
+    static int constexpr TILE = 64;
+
+    int cols;
+    int rows;
+    std::vector<unsigned long> lo;
+    std::vector<unsigned long> hi;
+
+    GrayTiles(int width, int height);
+
+    int index(int col, int row) const { return col + row * cols; }
+    bool uniform(int col, int row) const { return lo[index(col, row)] == hi[index(col, row)]; }
+};
+
+/*
+ * PlanarRgbMap
+ */
+
+/**
+ * An RgbMap with each channel in a plane of its own. Rows are padded to a
+ * multiple of 16 samples, so a filter can run a whole row of one channel
+ * through SIMD lanes without straddling pixels; the padding is zero.
+ */
+struct PlanarRgbMap
+{
+    static int constexpr ALIGN = 16;
+
+    int width;
+    int height;
+    int stride; ///< Samples from one row of a plane to the next.
+    std::vector<unsigned char, MapAllocator<unsigned char>> samples;
+
+    PlanarRgbMap(int width, int height);
+
+    /// Channel 0, 1 or 2 (r, g, b).
+    unsigned char       *plane(int channel)       { return samples.data() + (size_t)channel * stride * height; }
+    unsigned char const *plane(int channel) const { return samples.data() + (size_t)channel * stride * height; }
+    unsigned char       *row(int channel, int y)       { return plane(channel) + (size_t)y * stride; }
+    unsigned char const *row(int channel, int y) const { return plane(channel) + (size_t)y * stride; }
 };
 
 /*
  * IndexedMap
  */
 
+/**
+ * One byte per pixel: an index always falls inside the 256 entry clut.
+ */
 struct IndexedMap
-    : MapBase<unsigned>
+    : MapBase<unsigned char>
 {
     IndexedMap(int width, int height);
 
-    RGB getPixelValue(int x, int y) const { return clut[getPixel(x, y) % clut.size()]; }
+    RGB getPixelValue(int x, int y) const { return clut[getPixel(x, y)]; }
     bool writePPM(char const *fileName);
 
     int nrColors;
@@ -88,6 +171,14 @@ struct IndexedMap
 GrayMap rgbMapToGrayMap(RgbMap const &rgbmap);
 RgbMap grayMapToRgbMap(GrayMap const &graymap);
 RgbMap indexedMapToRgbMap(IndexedMap const &indexedmap);
+PlanarRgbMap rgbMapToPlanar(RgbMap const &rgbmap);
+/// Bounding box of the pixels that are not fully transparent.
+PixelBox rgbMapOpaqueBox(RgbMap const &rgbmap);
+/// Copy of a region, alpha included.
+RgbMap rgbMapCrop(RgbMap const &rgbmap, PixelBox const &box);
+RgbMap planarToRgbMap(PlanarRgbMap const &planar);
+/// Value range of every tile, grown by <halo> pixels on each side.
+GrayTiles grayMapTiles(GrayMap const &graymap, int halo = 0);
 
 
 
@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Binary dumps of image maps, for checkpointing the stages of a trace.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef INKSCAPE_TRACE_MAPDUMP_H
+#define INKSCAPE_TRACE_MAPDUMP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "imagemap.h"
+
+enum class DumpKind : uint32_t
+{
+    GRAY    = 1,
+    RGB     = 2,
+    INDEXED = 3,
+    BITMAP  = 4, ///< Packed potrace bitmap, see engines/potrace/bitmapdump.h.
+};
+
+/**
+ * A dump is this 64 byte header, <height> rows of <rowBytes> bytes each,
+ * then <extraBytes> of data of the kind: the alpha plane of an RgbMap, the
+ * clut and color count of an IndexedMap. Rows are stored as they are in
+ * memory, in the byte order of the machine that wrote them, and start 64
+ * byte aligned so that a mapped dump can be read in place.
+ */
+struct DumpHeader
+{
+    static uint32_t constexpr ORDER_MARK = 0x01020304;
+
+    char magic[8];       ///< "INKDUMP" and a version byte.
+    uint32_t byteOrder;  ///< ORDER_MARK, as the writer stores it.
+    DumpKind kind;
+    int32_t width;
+    int32_t height;
+    uint64_t rowBytes;
+    uint64_t extraBytes;
+    unsigned char reserved[24];
+};
+
+static_assert(sizeof(DumpHeader) == 64, "rows follow the header 64 byte aligned");
+
+/// Header of a dump of <kind>, everything else zero.
+DumpHeader dumpHeader(DumpKind kind, int width, int height, uint64_t rowBytes, uint64_t extraBytes = 0);
+
+/**
+ * Write a dump with a single large write per part. <rows> holds all rows
+ * back to back; <extra> may be null when the header has no extra bytes.
+ */
+bool writeDump(char const *fileName, DumpHeader const &header, void const *rows, void const *extra = nullptr);
+
+bool writeDump(char const *fileName, GrayMap const &graymap);
+bool writeDump(char const *fileName, RgbMap const &rgbmap);
+bool writeDump(char const *fileName, IndexedMap const &indexedmap);
+
+/**
+ * A dump mapped into memory. Pages are private: rows can be changed in
+ * place without touching the file, and are only copied when they are.
+ */
+class MappedDump
+{
+public:
+    /// nullopt when the file cannot be mapped or is not a valid dump.
+    static std::optional<MappedDump> open(char const *fileName);
+
+    MappedDump(MappedDump &&other) noexcept;
+    MappedDump &operator=(MappedDump &&other) noexcept;
+    MappedDump(MappedDump const &) = delete;
+    MappedDump &operator=(MappedDump const &) = delete;
+    ~MappedDump();
+
+    DumpHeader const &header() const { return *reinterpret_cast<DumpHeader const *>(base); }
+
+    unsigned char       *row(int y)       { return base + sizeof(DumpHeader) + y * header().rowBytes; }
+    unsigned char const *row(int y) const { return base + sizeof(DumpHeader) + y * header().rowBytes; }
+    /// The data after the rows.
+    unsigned char const *extra() const { return row(header().height); }
+
+private:
+    MappedDump(unsigned char *base, size_t size) : base(base), size(size) {}
+
+    unsigned char *base;
+    size_t size;
+};
+
+/**
+ * A map over the rows of a mapped dump, without copying them; valid as
+ * long as the dump is. The accessors are those of MapBase, and rows can be
+ * changed in place.
+ */
+template <typename T>
+struct MapView
+{
+    int width;
+    int height;
+    T *pixels;
+
+    size_t offset(int x, int y) const { return x + (size_t)y * width; }
+    T       *row(int y)       { return pixels + (size_t)y * width; }
+    T const *row(int y) const { return pixels + (size_t)y * width; }
+    void setPixel(int x, int y, T val) { pixels[offset(x, y)] = val; }
+    T getPixel(int x, int y) const { return pixels[offset(x, y)]; }
+};
+
+using GrayMapView = MapView<unsigned long>;
+
+struct RgbMapView
+    : MapView<RGB>
+{
+    unsigned char const *alpha; ///< Null when the map is opaque.
+};
+
+struct IndexedMapView
+    : MapView<unsigned char>
+{
+    RGB const *clut; ///< All 256 entries, as in IndexedMap.
+    int nrColors;
+
+    RGB getPixelValue(int x, int y) const { return clut[getPixel(x, y)]; }
+};
+
+/// Views of dumped maps; nullopt when the dump holds something else.
+std::optional<GrayMapView> grayMapView(MappedDump &dump);
+std::optional<RgbMapView> rgbMapView(MappedDump &dump);
+std::optional<IndexedMapView> indexedMapView(MappedDump &dump);
+
+/// Copies of dumped maps, for when they must outlive the file.
+std::optional<GrayMap> grayMapLoad(char const *fileName);
+std::optional<RgbMap> rgbMapLoad(char const *fileName);
+std::optional<IndexedMap> indexedMapLoad(char const *fileName);
+
+#endif // INKSCAPE_TRACE_MAPDUMP_H
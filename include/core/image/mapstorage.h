@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Storage of map pixels: on the heap, or in mapped files for huge images.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef INKSCAPE_TRACE_MAPSTORAGE_H
+#define INKSCAPE_TRACE_MAPSTORAGE_H
+
+#include <cstddef>
+#include <new>
+#include <string>
+
+/**
+ * Where the pixels of maps are kept. By default everything is on the heap.
+ * With a directory set, each map of at least <minBytes> goes to a file of
+ * its own there, unlinked as soon as it is created and mapped with a
+ * sequential access hint. The page cache then pages images in and out as
+ * the filters walk them, so very large inputs are traced within a fixed
+ * amount of RAM.
+ */
+struct MapStorage
+{
+    std::string directory; ///< Empty for heap only.
+    size_t minBytes = (size_t)64 << 20;
+};
+
+/// Applies to every map allocated afterwards, from any thread.
+void setMapStorage(MapStorage const &storage);
+MapStorage mapStorage();
+
+/// Memory for <bytes> of map pixels, mapped or from the heap as set up.
+/// Falls back to the heap when no file can be made or its space reserved.
+void *mapAllocate(size_t bytes);
+void mapDeallocate(void *memory, size_t bytes);
+
+/**
+ * Allocator of the pixel vectors of maps. It holds no state, so maps can
+ * still be copied, moved and swapped freely whatever their storage.
+ */
+template <typename T>
+struct MapAllocator
+{
+    using value_type = T;
+
+    MapAllocator() = default;
+    template <typename U>
+    MapAllocator(MapAllocator<U> const &) {}
+
+    T *allocate(size_t n)
+    {
+        if (n > (size_t)-1 / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T *>(mapAllocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *memory, size_t n) { mapDeallocate(memory, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(MapAllocator<U> const &) const { return true; }
+    template <typename U>
+    bool operator!=(MapAllocator<U> const &) const { return false; }
+};
+
+#endif // INKSCAPE_TRACE_MAPSTORAGE_H
@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Mip pyramid of an RgbMap, for previews at reduced resolution.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef INKSCAPE_TRACE_PYRAMID_H
+#define INKSCAPE_TRACE_PYRAMID_H
+
+#include <deque>
+#include <mutex>
+#include <optional>
+
+#include "imagemap.h"
+
+/**
+ * Level 0 is the image itself, each further level halves both sides (2x2
+ * box average) down to a single pixel. Levels are built on first use and
+ * kept; references to them stay valid for the life of the pyramid. Safe to
+ * use from several threads.
+ */
+class RgbPyramid
+{
+public:
+    explicit RgbPyramid(RgbMap base, int nrThreads = 0);
+
+    RgbPyramid(RgbPyramid const &) = delete;
+    RgbPyramid &operator=(RgbPyramid const &) = delete;
+
+    /// Number of levels, the last one being 1x1.
+    int levelCount() const { return nrLevels; }
+
+    RgbMap const &level(int index);
+
+    /// Smallest level with at least <minPixels> pixels, or level 0.
+    int levelFor(long minPixels) const;
+
+    /// Pixel count of a level, without building it.
+    long levelPixels(int index) const;
+
+private:
+    std::deque<RgbMap> levels;
+    std::mutex mutex;
+    int baseWidth;
+    int baseHeight;
+    int nrLevels;
+    int nrThreads;
+};
+
+/// Half-size 2x2 box average of an RgbMap; odd edges are averaged with themselves.
+RgbMap rgbMapHalve(RgbMap const &rgbmap, int nrThreads = 0);
+
+/// Halve an RgbMap until it has at most <maxPixels> pixels; nullopt if it
+/// already does.
+std::optional<RgbMap> rgbMapReduce(RgbMap const &rgbmap, long maxPixels, int nrThreads = 0);
+
+#endif // INKSCAPE_TRACE_PYRAMID_H
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Minimal helpers for splitting pixel loops over worker threads.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef INKSCAPE_TRACE_PARALLEL_H
+#define INKSCAPE_TRACE_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace Parallel {
+
+/**
+ * Resolve a requested thread count, 0 meaning one per hardware thread.
+ */
+inline int threadCount(int requested)
+{
+    if (requested > 0) {
+        return requested;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * Number of chunks to split <count> work items into, so that every chunk
+ * holds at least <grain> items and no more than <nrThreads> are used.
+ */
+inline int chunkCount(long count, int nrThreads, int grain)
+{
+    return std::clamp<long>(count / std::max(grain, 1), 1, threadCount(nrThreads));
+}
+
+/**
+ * Split [0, count) into <nrChunks> contiguous ranges and call
+ * fn(chunk, begin, end) for each of them. Chunk 0 runs on the calling thread,
+ * the others on their own threads; returns when all chunks are done.
+ */
+template <typename F>
+void forChunks(int count, int nrChunks, F &&fn)
+{
+    nrChunks = std::clamp(nrChunks, 1, std::max(count, 1));
+    auto bounds = [&](int chunk) {
+        return static_cast<int>(static_cast<long long>(count) * chunk / nrChunks);
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(nrChunks - 1);
+    for (int chunk = 1; chunk < nrChunks; chunk++) {
+        workers.emplace_back([&fn, chunk, begin = bounds(chunk), end = bounds(chunk + 1)] {
+            fn(chunk, begin, end);
+        });
+    }
+    fn(0, 0, bounds(1));
+    for (auto &w : workers) {
+        w.join();
+    }
+}
+
+/**
+ * Call fn(i) for every i in [0, count) on up to <nrThreads> threads, the
+ * threads picking the next index as they become free. Suited to items of
+ * very uneven cost.
+ */
+template <typename F>
+void forItems(int count, int nrThreads, F &&fn)
+{
+    std::atomic<int> next{0};
+    forChunks(std::min(count, threadCount(nrThreads)), threadCount(nrThreads), [&](int, int, int) {
+        for (int i = next++; i < count; i = next++) {
+            fn(i);
+        }
+    });
+}
+
+} // namespace Parallel
+
+#endif // INKSCAPE_TRACE_PARALLEL_H
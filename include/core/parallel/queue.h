@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Bounded blocking queue for handing work between pipeline stages.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef INKSCAPE_TRACE_QUEUE_H
+#define INKSCAPE_TRACE_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace Parallel {
+
+/**
+ * A FIFO holding at most <capacity> items. push() blocks while the queue is
+ * full, which is what keeps a fast producer from running ahead of a slow
+ * consumer. Once closed, push() fails and pop() drains what is left, then
+ * returns nullopt.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(int capacity)
+        : capacity(capacity > 0 ? capacity : 1)
+    {}
+
+    bool push(T item)
+    {
+        std::unique_lock lock(mutex);
+        notFull.wait(lock, [&] { return closed || (int)items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    std::optional<T> pop()
+    {
+        std::unique_lock lock(mutex);
+        notEmpty.wait(lock, [&] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return {};
+        }
+        auto item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return item;
+    }
+
+    void close()
+    {
+        std::lock_guard lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    int const capacity;
+    std::deque<T> items;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
+
+} // namespace Parallel
+
+#endif // INKSCAPE_TRACE_QUEUE_H
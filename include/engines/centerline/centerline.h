@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Centerline tracing: open stroked paths along the skeleton of line art.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef CENTERLINE_H
+#define CENTERLINE_H
+
+#include "core/core.h"
+#include "trace/trace.h"
+
+namespace Centerline {
+
+/**
+ * Traces TraceType::AUTOTRACE_CENTERLINE. The thresholded image is thinned
+ * to a one pixel skeleton, the skeleton is split into strokes between its
+ * ends and junctions, and every stroke becomes one open Bezier path. Each
+ * stroke keeps the width of the line it came from as its stroke-width;
+ * strokes of the same width share a result item.
+ */
+// 中线追踪引擎
+class CenterlineTracingEngine final : public TracingEngine {
+public:
+  CenterlineTracingEngine() = default;
+  CenterlineTracingEngine(double brightnessThreshold, // 亮度阈值
+                          bool invert                 // 是否反转
+  );
+
+  // 追踪
+  TraceResult trace(RgbMap const &rgbmap) const override;
+  // 预览 (骨架)
+  RgbMap preview(RgbMap const &rgbmap) const override;
+
+  // 设置简化容差 (像素)
+  void setTolerance(double);
+  // 设置毛刺长度: 更短的端点分支被去掉
+  void setSpurLength(int);
+  // 设置线程数 (0: 每核一个)
+  void setThreads(int);
+
+private:
+  // 亮度阈值
+  double brightnessThreshold = 0.45;
+  // 是否反转
+  bool invert = false;
+  // 简化容差
+  double tolerance = 1.0;
+  // 毛刺长度
+  int spurLength = 3;
+  // 线程数
+  int nrThreads = 0;
+};
+
+} // namespace Centerline
+
+#endif // CENTERLINE_H
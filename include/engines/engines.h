@@ -2,5 +2,6 @@
 #define ENGINES_H
 
 #include "engines/potrace/potrace.h"
+#include "engines/centerline/centerline.h"
 
 #endif // ENGINES_H
\ No newline at end of file
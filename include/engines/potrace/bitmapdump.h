@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Binary dumps of packed potrace bitmaps
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef POTRACE_BITMAPDUMP_H
+#define POTRACE_BITMAPDUMP_H
+
+#include <optional>
+#include <potracelib.h>
+
+#include "core/image/mapdump.h"
+
+namespace Potrace {
+
+/**
+ * Write <bm> as a DumpKind::BITMAP dump: its words as they are in memory,
+ * dy words per row.
+ */
+bool bitmapWriteDump(char const *fileName, potrace_bitmap_t const *bm);
+
+/**
+ * A bitmap over the words of a mapped dump, without copying them; valid as
+ * long as <dump> is. It can be cleaned up or traced in place, bm_dup() it
+ * to keep it. nullopt when the dump holds no bitmap.
+ */
+std::optional<potrace_bitmap_t> bitmapView(MappedDump &dump);
+
+} // namespace Potrace
+
+#endif // POTRACE_BITMAPDUMP_H
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Speckle removal and morphology on packed potrace bitmaps
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef POTRACE_CLEANUP_H
+#define POTRACE_CLEANUP_H
+
+#include <potracelib.h>
+
+namespace Potrace {
+
+/**
+ * Cleanup applied to a bitmap before it is handed to potrace. Specks are
+ * removed first, then the opening and the closing are applied.
+ */
+struct BitmapCleanup {
+  long minArea = 0; // black specks and white holes smaller than this, in pixels
+  int open = 0;     // radius of a morphological opening
+  int close = 0;    // radius of a morphological closing
+
+  bool enabled() const { return minArea > 0 || open > 0 || close > 0; }
+};
+
+/**
+ * Remove the 8-connected groups of set pixels smaller than <minArea>.
+ */
+void bitmapRemoveSpecks(potrace_bitmap_t *bm, long minArea, int nrThreads);
+
+/**
+ * Apply <cleanup> to <bm> in place. Returns false if memory ran out, the
+ * bitmap is then only partly cleaned.
+ */
+bool bitmapCleanup(potrace_bitmap_t *bm, BitmapCleanup const &cleanup,
+                   int nrThreads);
+
+} // namespace Potrace
+
+#endif // POTRACE_CLEANUP_H
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Connected component labeling on packed potrace bitmaps
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef POTRACE_COMPONENTS_H
+#define POTRACE_COMPONENTS_H
+
+#include <vector>
+#include <potracelib.h>
+
+namespace Potrace {
+
+/**
+ * Set pixels [x0, x1) of row y.
+ */
+struct PixelRun {
+  int y;
+  int x0;
+  int x1;
+};
+
+/**
+ * A group of set pixels that potrace decomposes independently of every
+ * other group. Runs are in raster order.
+ */
+struct BitmapComponent {
+  int x0, y0, x1, y1; // bounding box, exclusive upper bounds
+  long area;          // number of set pixels
+  std::vector<PixelRun> runs;
+};
+
+/**
+ * Pixels closer than this (Chebyshev distance) end up in the same component.
+ * Potrace resolves ambiguous diagonal turns by looking at the pixels up to
+ * four steps around a corner, so groups further apart than that are traced
+ * exactly as they would be within the whole bitmap.
+ */
+int constexpr COMPONENT_REACH = 5;
+
+/**
+ * Label the components of a bitmap, in the raster order of their first
+ * pixel. Pixels at most <reach> apart are connected, a reach of 1 gives
+ * plain 8-connectivity. Rows are scanned and labeled on up to <nrThreads>
+ * threads.
+ */
+std::vector<BitmapComponent> bitmapComponents(potrace_bitmap_t const *bm,
+                                              int nrThreads,
+                                              int reach = COMPONENT_REACH);
+
+/**
+ * Whether some row holds more than <length> consecutive set pixels. Such a
+ * run lies inside a path of larger area, so potrace keeps that path
+ * whenever <length> is at least its turdsize.
+ */
+bool bitmapHasRun(potrace_bitmap_t const *bm, int length);
+
+} // namespace Potrace
+
+#endif // POTRACE_COMPONENTS_H
@@ -115,4 +115,159 @@ static inline void bm_invert(potrace_bitmap_t *bm) {
   }
 }
 
+/* set pixels [x0, x1) of row y, whole words at a time. Assumes
+   0 <= x0 <= x1 <= w. */
+static inline void bm_setrange(potrace_bitmap_t *bm, int y, int x0, int x1) {
+  potrace_word *line = bm_scanline(bm, y);
+  if (x0 >= x1) {
+    return;
+  }
+  int k0 = x0 / BM_WORDBITS;
+  int k1 = (x1 - 1) / BM_WORDBITS;
+  potrace_word first = BM_ALLBITS >> (x0 & (BM_WORDBITS - 1));
+  potrace_word last = BM_ALLBITS << (BM_WORDBITS - 1 - ((x1 - 1) & (BM_WORDBITS - 1)));
+  if (k0 == k1) {
+    line[k0] |= first & last;
+    return;
+  }
+  line[k0] |= first;
+  for (int k = k0 + 1; k < k1; k++) {
+    line[k] = BM_ALLBITS;
+  }
+  line[k1] |= last;
+}
+
+/* return 1 if no pixel of the bitmap is set. Assumes the bits past the
+   width are clear. */
+static inline int bm_isclear(const potrace_bitmap_t *bm) {
+  ptrdiff_t size = (ptrdiff_t)bm->dy * (ptrdiff_t)bm->h;
+  for (ptrdiff_t i = 0; i < size; i++) {
+    if (bm->map[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* clear pixels [x0, x1) of row y, whole words at a time. Assumes
+   0 <= x0 <= x1 <= w. */
+static inline void bm_clearrange(potrace_bitmap_t *bm, int y, int x0, int x1) {
+  potrace_word *line = bm_scanline(bm, y);
+  if (x0 >= x1) {
+    return;
+  }
+  int k0 = x0 / BM_WORDBITS;
+  int k1 = (x1 - 1) / BM_WORDBITS;
+  potrace_word first = BM_ALLBITS >> (x0 & (BM_WORDBITS - 1));
+  potrace_word last = BM_ALLBITS << (BM_WORDBITS - 1 - ((x1 - 1) & (BM_WORDBITS - 1)));
+  if (k0 == k1) {
+    line[k0] &= ~(first & last);
+    return;
+  }
+  line[k0] &= ~first;
+  for (int k = k0 + 1; k < k1; k++) {
+    line[k] = 0;
+  }
+  line[k1] &= ~last;
+}
+
+/* mask of the bits of the last word of a row that lie inside the bitmap */
+static inline potrace_word bm_lastmask(const potrace_bitmap_t *bm) {
+  int r = bm->w % BM_WORDBITS;
+  return r == 0 ? BM_ALLBITS : BM_ALLBITS << (BM_WORDBITS - r);
+}
+
+/* return 1 if every pixel of the bitmap is set */
+static inline int bm_isfull(const potrace_bitmap_t *bm) {
+  potrace_word const last = bm_lastmask(bm);
+  for (int y = 0; y < bm->h; y++) {
+    potrace_word const *line = bm_scanline(bm, y);
+    for (int k = 0; k + 1 < bm->dy; k++) {
+      if (line[k] != BM_ALLBITS) {
+        return 0;
+      }
+    }
+    if (bm->dy && (line[bm->dy - 1] & last) != last) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* one step of 3x3 dilation (dilate != 0) or erosion, in place, one word
+   of pixels at a time: a horizontal pass shifts each word by one pixel
+   with the carry from its neighbour words, a vertical pass combines three
+   rows. Dilation sees the outside of the bitmap as background, erosion as
+   foreground, so that opening and closing never move the border. Returns
+   0 on success, -1 with errno set on error. */
+static inline int bm_morph(potrace_bitmap_t *bm, int dilate) {
+  ptrdiff_t size = (ptrdiff_t)bm->dy * (ptrdiff_t)bm->h;
+  if (size == 0) {
+    return 0;
+  }
+  potrace_word *tmp = (potrace_word *) malloc(size * BM_WORDSIZE);
+  if (!tmp) {
+    return -1;
+  }
+  potrace_word const pad = dilate ? 0 : BM_ALLBITS;
+  potrace_word const last = bm_lastmask(bm);
+  int const dy = bm->dy;
+
+  for (int y = 0; y < bm->h; y++) {
+    potrace_word *line = bm_scanline(bm, y);
+    potrace_word *out = tmp + (ptrdiff_t)y * dy;
+    if (!dilate) {
+      line[dy - 1] |= ~last; /* outside pixels of the last word */
+    }
+    for (int k = 0; k < dy; k++) {
+      potrace_word w = line[k];
+      potrace_word prev = k > 0 ? line[k - 1] : pad;
+      potrace_word next = k + 1 < dy ? line[k + 1] : pad;
+      potrace_word l = (w >> 1) | (prev << (BM_WORDBITS - 1)); /* pixel x - 1 */
+      potrace_word r = (w << 1) | (next >> (BM_WORDBITS - 1)); /* pixel x + 1 */
+      out[k] = dilate ? (w | l | r) : (w & l & r);
+    }
+  }
+
+  for (int y = 0; y < bm->h; y++) {
+    potrace_word *line = bm_scanline(bm, y);
+    potrace_word const *mid = tmp + (ptrdiff_t)y * dy;
+    potrace_word const *up = y > 0 ? mid - dy : nullptr;
+    potrace_word const *down = y + 1 < bm->h ? mid + dy : nullptr;
+    for (int k = 0; k < dy; k++) {
+      potrace_word u = up ? up[k] : pad;
+      potrace_word d = down ? down[k] : pad;
+      line[k] = dilate ? (mid[k] | u | d) : (mid[k] & u & d);
+    }
+    line[dy - 1] &= last;
+  }
+
+  free(tmp);
+  return 0;
+}
+
+/* morphological opening with a (2n+1)x(2n+1) square: removes features
+   thinner than the square. Returns 0 on success, -1 on error. */
+static inline int bm_open(potrace_bitmap_t *bm, int n) {
+  for (int i = 0; i < n; i++) {
+    if (bm_morph(bm, 0)) return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    if (bm_morph(bm, 1)) return -1;
+  }
+  return 0;
+}
+
+/* morphological closing with a (2n+1)x(2n+1) square: fills gaps and holes
+   thinner than the square. Returns 0 on success, -1 on error. */
+static inline int bm_close(potrace_bitmap_t *bm, int n) {
+  for (int i = 0; i < n; i++) {
+    if (bm_morph(bm, 1)) return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    if (bm_morph(bm, 0)) return -1;
+  }
+  return 0;
+}
+
 #endif /* BITMAP_H */
@@ -6,17 +6,39 @@
 #include <string>
 #include <memory>
 #include <initializer_list>
+#include <map>
 #include <potracelib.h>
 
 #include "core/core.h"
 #include "trace/trace.h"
+#include "filters/quantize/quantize.h"
 #include "pbitmap.h"
+#include "cleanup.h"
 
 using potrace_param_t = struct potrace_param_s;
 using potrace_path_t = struct potrace_path_s;
 
 namespace Potrace {
 
+// 位图删除器
+struct potrace_bitmap_deleter {
+  void operator()(potrace_bitmap_t *p) { bm_free(p); };
+};
+using potrace_bitmap_uniqptr =
+    std::unique_ptr<potrace_bitmap_t, potrace_bitmap_deleter>;
+
+// Potrace 参数删除器
+struct potrace_param_deleter {
+  void operator()(potrace_param_t *p) { potrace_param_free(p); };
+};
+using potrace_param_uniqptr =
+    std::unique_ptr<potrace_param_t, potrace_param_deleter>;
+
+/**
+ * The setters configure the engine; once configured it is never modified
+ * by tracing, so a single engine can be shared by any number of threads
+ * tracing concurrently.
+ */
 // Potrace 追踪引擎
 class PotraceTracingEngine final : public TracingEngine {
 public:
@@ -34,14 +56,19 @@ public:
                        bool multiScanRemoveBackground        // 多扫描移除背景
   );
 
-  ~PotraceTracingEngine() override;
-
   // 追踪
-  TraceResult trace(RgbMap const &rgbmap) override;
+  TraceResult trace(RgbMap const &rgbmap) const override;
+  // 逐层追踪
+  void traceStream(RgbMap const &rgbmap,
+                   TraceItemSink const &sink) const override;
   // 预览
-  RgbMap preview(RgbMap const &rgbmap) override;
+  RgbMap preview(RgbMap const &rgbmap) const override;
+  // 渐进追踪 (量化类型沿用粗略一遍的调色板)
+  TraceResult
+  traceProgressive(RgbMap const &rgbmap, TraceCallback const &onResult,
+                   ProgressiveOptions const &options = {}) const override;
   // 追踪灰度图
-  TraceResult traceGrayMap(GrayMap const &grayMap);
+  TraceResult traceGrayMap(GrayMap const &grayMap) const;
   // 设置优化曲线
   void setOptiCurve(int);
   // 设置优化容差
@@ -50,10 +77,16 @@ public:
   void setAlphaMax(double);
   // 设置斑点大小
   void setTurdSize(int);
+  // 设置量化选项
+  void setQuantizeOptions(QuantizeOptions const &);
+  // 设置追踪线程数 (1: 单次追踪, 0: 每核一个线程)
+  void setTraceThreads(int);
+  // 设置某追踪类型的位图预处理 (去斑点 + 形态学)
+  void setBitmapCleanup(TraceType, BitmapCleanup const &);
 
 private:
   // Potrace 参数
-  potrace_param_t *potraceParams;
+  potrace_param_uniqptr potraceParams;
 
   // 追踪类型
   TraceType traceType = TraceType::BRIGHTNESS;
@@ -79,24 +112,59 @@ private:
   // 多扫描移除背景
   bool multiScanRemoveBackground = false;
 
+  // 量化选项
+  QuantizeOptions quantizeOptions;
+
+  // 追踪线程数
+  int traceThreads = 1;
+
+  // 各追踪类型的位图预处理
+  std::map<TraceType, BitmapCleanup> cleanups;
+
   // 初始化
   void common_init();
 
-  // 量化
-  TraceResult traceQuant(RgbMap const &rgbmap);
+  // 量化 (palette 非空时返回所用调色板)
+  void traceQuant(RgbMap const &rgbmap, QuantizeOptions const &options,
+                  TraceItemSink const &sink,
+                  ColorTable *palette = nullptr) const;
   // 亮度多
-  TraceResult traceBrightnessMulti(RgbMap const &rgbmap);
+  void traceBrightnessMulti(RgbMap const &rgbmap,
+                            TraceItemSink const &sink) const;
   // 单
-  TraceResult traceSingle(RgbMap const &rgbmap);
+  void traceSingle(RgbMap const &rgbmap, TraceItemSink const &sink) const;
+  // 按追踪类型分派 (图像已裁剪到不透明部分)
+  void traceRegion(RgbMap const &rgbmap, TraceItemSink const &sink) const;
 
   // 过滤索引
   IndexedMap filterIndexed(RgbMap const &rgbmap) const;
-  // 过滤
-  std::optional<GrayMap> filter(RgbMap const &rgbmap) const;
+  // 过滤 (亮度类型取 [floor, threshold) 之间为黑)
+  std::optional<GrayMap> filter(RgbMap const &rgbmap, double threshold,
+                                double floor) const;
+  // 多层追踪 (按需跳过背景层)
+  void traceLayers(std::vector<potrace_bitmap_uniqptr> &layers,
+                   std::vector<std::string> const &styles,
+                   TraceItemSink const &sink) const;
+  // 灰度图转位图
+  potrace_bitmap_uniqptr grayMapToBitmap(GrayMap const &gm) const;
+  // 亮度阈值 (含反转) 直接转位图, 与 filter + grayMapToBitmap 结果相同
+  potrace_bitmap_uniqptr brightnessBitmap(RgbMap const &rgbmap, double threshold,
+                                          double floor) const;
   // 灰度图直接转 SVG 路径字符串
-  std::string grayMapToSvg(GrayMap const &gm);
+  std::string grayMapToSvg(GrayMap const &gm) const;
+  // 位图直接转 SVG 路径字符串
+  std::string bitmapToSvg(potrace_bitmap_t *bitmap) const;
+  // 位图预处理
+  void prepareBitmap(potrace_bitmap_t *bitmap) const;
+  // 追踪预处理过的位图
+  std::string traceBitmap(potrace_bitmap_t const *bitmap) const;
+  // 按连通分量并行追踪位图
+  std::string bitmapToSvgByComponents(potrace_bitmap_t const *bitmap) const;
+  // 路径与位图的位置无关, 可裁剪或分块追踪 (随机转向策略除外)
+  bool translationInvariant() const;
   // 直接写 SVG 路径字符串
-  void writePathsToSvg(potrace_path_t *paths, std::ostringstream &out) const;
+  void writePathsToSvg(potrace_path_t *paths, std::ostringstream &out,
+                       int dx = 0, int dy = 0) const;
 };
 
 } // namespace Potrace
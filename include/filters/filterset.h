@@ -27,9 +27,16 @@ GrayMap grayMapGaussian(GrayMap const &gmap);
  */
 RgbMap rgbMapGaussian(RgbMap const &rgbmap);
 
+/**
+ * Apply gaussian blur to an RgbMap that is no longer needed, reusing its
+ * pixels for the result.
+ */
+RgbMap rgbMapGaussian(RgbMap &&rgbmap);
+
 GrayMap grayMapCanny(GrayMap const &gmap, double lowThreshold, double highThreshold);
 
-GrayMap quantizeBand(RgbMap const &rgbmap, int nrColors);
+GrayMap quantizeBand(RgbMap const &rgbmap, int nrColors,
+                     QuantizeOptions const &options = {});
 
 
 #endif // INKSCAPE_TRACE_FILTERSET_H
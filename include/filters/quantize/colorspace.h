@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Perceptual color space conversion for quantization
+ *
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef INKSCAPE_TRACE_COLORSPACE_H
+#define INKSCAPE_TRACE_COLORSPACE_H
+
+#include "core/core.h"
+
+/*
+ * Oklab colors are stored in RGB triplets: r holds L, g holds a and b holds b.
+ * All three axes share the same scale (1.0 -> 255) so that squared byte
+ * distances stay perceptually uniform; a and b are offset to fit the sRGB
+ * gamut into 0..255.
+ */
+
+/**
+ * Convert an sRGB color to scaled Oklab.
+ */
+RGB rgbToOklab(RGB rgb);
+
+/**
+ * Convert a scaled Oklab color back to sRGB, clamping out of gamut values.
+ */
+RGB oklabToRgb(RGB lab);
+
+/**
+ * Convert a whole sRGB image to scaled Oklab.
+ */
+RgbMap rgbMapToOklab(RgbMap const &rgbmap, int nrThreads = 0);
+
+#endif // INKSCAPE_TRACE_COLORSPACE_H
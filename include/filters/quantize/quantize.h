@@ -13,16 +13,102 @@
 #define INKSCAPE_TRACE_QUANTIZE_H
 
 #include "core/core.h"
+#include <array>
 #include <cassert>
 #include <cstdio>
 #include <memory>
-#include "pool.h"
 
 
+/**
+ * Palette construction method.
+ */
+enum class QuantizeMethod
+{
+    OCTREE,    ///< Merged octree, pruned by minimal impact.
+    MEDIAN_CUT ///< Recursive split of the color histogram at the median.
+};
+
+/**
+ * Color space in which palettes are built and pixels are matched.
+ */
+enum class QuantizeSpace
+{
+    RGB,  ///< Raw sRGB components.
+    OKLAB ///< Perceptual Oklab, fewer colors are needed for the same quality.
+};
+
+/**
+ * Pixels the palette is built from. The whole image is always mapped to the
+ * resulting palette; only palette construction looks at fewer pixels.
+ */
+enum class PaletteSampling
+{
+    FULL,       ///< Every pixel.
+    STRIDED,    ///< One pixel at a fixed position of every cell of a regular grid.
+    STRATIFIED, ///< One pseudo-random pixel of every grid cell, no aliasing on patterns.
+    MIPMAP      ///< The average of every grid cell, i.e. a box downscaled image.
+};
+
+/**
+ * A quantization palette, sorted by increasing brightness.
+ */
+struct ColorTable
+{
+    int nrColors = 0;
+    std::array<RGB, 256> clut{}; ///< Color look-up table.
+};
+
+/**
+ * Options for rgbMapQuantize().
+ */
+struct QuantizeOptions
+{
+    QuantizeMethod method = QuantizeMethod::OCTREE;
+    QuantizeSpace space = QuantizeSpace::RGB;
+    PaletteSampling sampling = PaletteSampling::FULL;
+    int sampleBudget = 1 << 18; ///< Grid cells are sized to give about this many samples.
+    int refineIterations = 0; ///< k-means passes refining the palette, 0 to disable.
+    int refineSampleStep = 1; ///< k-means only looks at every n-th pixel of every n-th row.
+    int nrThreads = 0;        ///< Threads for pixel assignment, 0 for one per core.
+    /// Map onto this palette, as is, instead of building one; keeps colors
+    /// and their order stable across passes over the same image.
+    std::shared_ptr<ColorTable const> palette;
+};
+
 /**
  * Quantize an RGB image to a reduced number of colors.
  */
-IndexedMap rgbMapQuantize(RgbMap const &rgbmap, int nrColors);
+IndexedMap rgbMapQuantize(RgbMap const &rgbmap, int nrColors,
+                          QuantizeOptions const &options = {});
+
+/**
+ * Receives the palette indices of a quantized image row by row, so callers
+ * can consume them without an IndexedMap in between.
+ */
+class IndexRowSink
+{
+public:
+    virtual ~IndexRowSink() = default;
+
+    /**
+     * Called once before any row, when the palette size is known.
+     */
+    virtual void begin(int width, int height, int nrColors) = 0;
+
+    /**
+     * Called exactly once per row. Rows may arrive out of order and from
+     * several threads at once; <indices> is only valid during the call.
+     */
+    virtual void row(int y, unsigned const *indices) = 0;
+};
+
+/**
+ * Quantize an RGB image, streaming the index rows into <sink>. With an
+ * Oklab palette built here, rows follow only once every pixel is matched:
+ * the exact colors of the entries decide their order.
+ */
+ColorTable rgbMapQuantize(RgbMap const &rgbmap, int nrColors, IndexRowSink &sink,
+                          QuantizeOptions const &options = {});
 
 
 #endif // INKSCAPE_TRACE_QUANTIZE_H
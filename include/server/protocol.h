@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Wire format of the local trace server.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef SERVER_PROTOCOL_H
+#define SERVER_PROTOCOL_H
+
+#include <cstdint>
+
+#include "capi/ink.h"
+
+/*
+ * Client and server share the machine, so every field is in host byte
+ * order. A connection carries any number of requests, each answered in
+ * order:
+ *
+ *   request:  RequestHeader, then payloadSize bytes of pixels unless
+ *             REQUEST_PIXELS_FD is set, in which case the header arrives
+ *             with one descriptor (SCM_RIGHTS) whose contents, from
+ *             fdOffset on, are the pixels: a memfd, shm object or file.
+ *             A memfd sealed with F_SEAL_SHRINK is mapped in place, any
+ *             other descriptor is copied from.
+ *   response: ResponseHeader, then payloadSize bytes. On success the
+ *             payload is the SVG document (REQUEST_SVG), or else itemCount
+ *             records of [u32 styleLength, style, u32 pathLength, path].
+ *             On failure it is the error message.
+ */
+namespace Server {
+
+uint32_t constexpr REQUEST_MAGIC = 0x514b4e49;  // "INKQ"
+uint32_t constexpr RESPONSE_MAGIC = 0x524b4e49; // "INKR"
+uint32_t constexpr PROTOCOL_VERSION = 1;
+
+// 请求标志
+uint32_t constexpr REQUEST_PIXELS_FD = 1 << 0; // 像素随文件描述符传递
+uint32_t constexpr REQUEST_SVG = 1 << 1;       // 返回完整 SVG 文档
+
+// 响应状态
+enum ResponseStatus : int32_t {
+  STATUS_OK = 0,
+  STATUS_BAD_REQUEST = 1,
+  STATUS_TRACE_FAILED = 2,
+};
+
+// 请求头
+struct RequestHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+  int32_t width;
+  int32_t height;
+  int32_t format; // ink_pixel_format
+  int64_t stride;
+  uint64_t payloadSize; // 内联像素字节数
+  uint64_t fdOffset;    // 描述符中像素的起始偏移
+  ink_params params;    // 由 ink_params_init 初始化
+};
+
+// 响应头
+struct ResponseHeader {
+  uint32_t magic;
+  int32_t status;
+  uint32_t itemCount;
+  uint32_t reserved;
+  uint64_t queueMicros; // 排队时间
+  uint64_t traceMicros; // 追踪时间
+  uint64_t payloadSize;
+};
+
+} // namespace Server
+
+#endif // SERVER_PROTOCOL_H
@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Long-running local trace server on a Unix domain socket.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#ifndef SERVER_SERVER_H
+#define SERVER_SERVER_H
+
+#include <string>
+
+namespace Server {
+
+// 服务选项
+struct ServerOptions {
+  std::string socketPath; // Unix 套接字路径
+  int workers = 0;        // 同时追踪的请求数 (0: 每核一个)
+  int queueDepth = 64;    // 等待追踪的请求上限
+  bool verbose = false;   // 逐请求报告延迟
+};
+
+/**
+ * Serve requests (see protocol.h) until SIGINT or SIGTERM. Engines stay
+ * warm across requests in one cache shared by all workers, keyed by their
+ * parameters and evicting the least recently used, and inline pixel
+ * buffers are recycled. Reader threads block once queueDepth
+ * requests are waiting, which in turn stalls their clients. A trace uses
+ * at most its worker's share of the cores, whatever threads the client
+ * asked for, and connections past a fixed limit are closed right away.
+ * Latency percentiles are printed on shutdown. Returns the process exit
+ * code.
+ */
+int serve(ServerOptions const &options);
+
+} // namespace Server
+
+#endif // SERVER_SERVER_H
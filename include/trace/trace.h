@@ -1,6 +1,8 @@
 #ifndef INKSCAPE_TRACE_H
 #define INKSCAPE_TRACE_H
 
+#include <atomic>
+#include <functional>
 #include <string>
 #include <utility>
 #include <vector>
@@ -20,7 +22,7 @@ enum class TraceType {
   // Used in tracedialog.cpp
   AUTOTRACE_SINGLE,    // 自动单（未使用）
   AUTOTRACE_MULTI,     // 自动多（未使用）
-  AUTOTRACE_CENTERLINE // 自动中线（未使用）
+  AUTOTRACE_CENTERLINE // 自动中线 (Centerline 引擎)
 };
 
 // 追踪结果项 - 直接存储 SVG 路径数据，无需复杂转换
@@ -46,6 +48,37 @@ public:
   void saveToSvg(const std::string& filename, int width, int height) const;
 };
 
+// 逐项接收追踪结果, 每层追踪完即调用一次
+using TraceItemSink = std::function<void(TraceResultItem &&item)>;
+
+// 预览预算
+struct PreviewBudget {
+  long minPixels = 0;   // 预览至少保留的像素数 (0: 原尺寸)
+  double maxMillis = 0; // 预览耗时上限, 优先于像素数 (0: 不限)
+};
+
+// 渐进追踪选项
+struct ProgressiveOptions {
+  long coarsePixels = 1 << 18; // 粗略一遍的像素上限
+  bool stablePalette = true;   // 精细一遍沿用粗略一遍的调色板
+};
+
+// 渐进结果回调: 先粗后精, final 为真表示最终结果
+using TraceCallback = std::function<void(TraceResult const &, bool final)>;
+
+/**
+ * Scale every coordinate of a result, along with any stroke widths, e.g.
+ * to bring a trace of a reduced image back to full size.
+ */
+TraceResult scaleTraceResult(TraceResult const &result, double sx, double sy);
+
+/**
+ * Move every absolute coordinate of an item, e.g. to place a trace of a
+ * cropped image back where the crop came from.
+ */
+TraceResultItem translateTraceItem(TraceResultItem const &item, double dx,
+                                   double dy);
+
 /**
  * A generic interface for plugging different autotracers into Inkscape.
  * 一个通用的接口，用于将不同的自动追踪器插入到 Inkscape 中。
@@ -63,16 +96,47 @@ class TracingEngine {
      * of SVG <path> elements. No geometric conversion is needed.
      *
      * This function will be called off-main-thread, so is required to be
-     * thread-safe. The lack of const however indicates that it is not required to
-     * be re-entrant.
+     * thread-safe. It is also required to be re-entrant: once configured, one
+     * engine may serve any number of concurrent traces.
+     */
+    virtual TraceResult trace(RgbMap const &rgbmap) const = 0;
+
+    /**
+     * Like trace(), but hand each item to <sink> as soon as it is known,
+     * in the order trace() would list them, instead of collecting them. Engines
+     * tracing several layers override this to free each layer before the
+     * next; the default emits the items of trace().
      */
-    virtual TraceResult trace(RgbMap const &rgbmap) = 0;
+    virtual void traceStream(RgbMap const &rgbmap,
+                             TraceItemSink const &sink) const;
   
     /**
      * Generate a quick preview without any actual tracing. Like trace(), this
-     * must be thread-safe.
+     * must be thread-safe and re-entrant.
      */
-    virtual RgbMap preview(RgbMap const &rgbmap) = 0;
+    virtual RgbMap preview(RgbMap const &rgbmap) const = 0;
+
+    /**
+     * Preview at reduced resolution: run preview() on the smallest pyramid
+     * level still holding budget.minPixels pixels, then step further down
+     * while the time estimated from earlier previews exceeds
+     * budget.maxMillis. The result has the size of the level used.
+     */
+    RgbMap previewScaled(RgbPyramid &pyramid, PreviewBudget const &budget) const;
+
+    /**
+     * Progressive trace. When the image has more than options.coarsePixels
+     * pixels, a reduced copy is traced first and handed to <onResult> in
+     * full-size coordinates, then the image is traced at full resolution.
+     * The final result goes to <onResult> as well, and is returned.
+     */
+    virtual TraceResult traceProgressive(RgbMap const &rgbmap,
+                                         TraceCallback const &onResult,
+                                         ProgressiveOptions const &options = {}) const;
+
+  private:
+    // 最近预览的每像素耗时 (纳秒), 用于估计; 并发预览间共享
+    mutable std::atomic<double> previewNanosPerPixel = 0;
   };
 
 /**
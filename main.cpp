@@ -1,79 +1,187 @@
+#include "cli/options.h"
+#include "cli/pipeline.h"
 #include "engines/engines.h"
+#include "server/server.h"
 #include "trace/trace.h"
+#include <cstdio>
 #include <cstring>
+#include <fstream>
 #include <opencv2/opencv.hpp>
 
 using namespace Potrace;
 
-// 将OpenCV Mat转换为RgbMap
-RgbMap matToRgbMap(const cv::Mat &mat) {
-  cv::Mat rgb_mat;
-  if (mat.channels() == 3) {
-    cv::cvtColor(mat, rgb_mat, cv::COLOR_BGR2RGB);
-  } else {
-    cv::cvtColor(mat, rgb_mat, cv::COLOR_GRAY2RGB);
+// 将OpenCV Mat转换为RgbMap, 带透明通道时合成到白色背景上并保留不透明度
+RgbMap matToRgbMap(const cv::Mat &image) {
+  cv::Mat mat = image;
+  if (mat.depth() != CV_8U) {
+    // 16 位 PNG 等
+    image.convertTo(mat, CV_8U, 1.0 / 257.0);
   }
 
-  int width = rgb_mat.cols;
-  int height = rgb_mat.rows;
-  int nchannels = rgb_mat.channels();
+  int width = mat.cols;
+  int height = mat.rows;
+  int nchannels = mat.channels();
 
   auto rgbmap = RgbMap(width, height);
+  if (nchannels == 4) {
+    rgbmap.alpha.resize((size_t)width * height);
+  }
+  bool opaque = true;
+
+  // 与原先一致: 每个通道按 v * alpha / 256 + (255 - alpha) 合成到白色上,
+  // 不透明像素因此仍是 v * 255 / 256
+  auto blend = [](int value, int alpha) {
+    return (unsigned char)(value * alpha / 256 + 255 - alpha);
+  };
 
   for (int y = 0; y < height; y++) {
+    auto src = mat.ptr<unsigned char>(y);
+    auto dst = rgbmap.row(y);
     for (int x = 0; x < width; x++) {
-      auto pixel = rgb_mat.at<cv::Vec3b>(y, x);
-      int alpha = 255;
-      int white = 255 - alpha; // = 0，因为alpha=255
-      unsigned char r = (int)pixel[0] * alpha / 256 + white;
-      unsigned char g = (int)pixel[1] * alpha / 256 + white;
-      unsigned char b = (int)pixel[2] * alpha / 256 + white;
-      rgbmap.setPixel(x, y, {r, g, b});
+      if (nchannels == 1) {
+        auto gray = blend(src[x], 255);
+        dst[x] = {gray, gray, gray};
+      } else if (nchannels == 3) {
+        auto pixel = src + 3 * x;
+        dst[x] = {blend(pixel[2], 255), blend(pixel[1], 255),
+                  blend(pixel[0], 255)};
+      } else {
+        auto pixel = src + 4 * x;
+        int alpha = pixel[3];
+        dst[x] = {blend(pixel[2], alpha), blend(pixel[1], alpha),
+                  blend(pixel[0], alpha)};
+        rgbmap.alpha[rgbmap.offset(x, y)] = alpha;
+        opaque = opaque && alpha == 255;
+      }
     }
   }
 
+  // 全不透明时不必保留
+  if (opaque) {
+    rgbmap.alpha.clear();
+  }
+
   return rgbmap;
 }
 
+// 读取 JPEG 尺寸, 只解析到帧头 (SOF) 为止
+std::optional<std::pair<int, int>> jpegSize(std::string const &imageFile) {
+  std::ifstream in(imageFile, std::ios::binary);
+  auto byte = [&]() { return in.get(); };
+  if (byte() != 0xFF || byte() != 0xD8) {
+    return {};
+  }
+  while (in) {
+    int marker = byte();
+    if (marker != 0xFF) {
+      return {};
+    }
+    while (marker == 0xFF) {
+      marker = byte();
+    }
+    int length = byte() << 8;
+    length |= byte();
+    if (!in || length < 2) {
+      return {};
+    }
+    bool sof = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+               marker != 0xC8 && marker != 0xCC;
+    if (sof) {
+      byte(); // precision
+      int height = byte() << 8;
+      height |= byte();
+      int width = byte() << 8;
+      width |= byte();
+      if (!in) {
+        return {};
+      }
+      return std::make_pair(width, height);
+    }
+    in.seekg(length - 2, std::ios::cur);
+  }
+  return {};
+}
 
+/**
+ * Decode an image, at reduced scale when at least <minPixels> pixels are
+ * enough: JPEG decodes directly at 1/2, 1/4 or 1/8 scale. Other formats
+ * keep their alpha channel.
+ */
+cv::Mat decodeReduced(std::string const &imageFile, long minPixels) {
+  if (auto size = jpegSize(imageFile)) {
+    if (minPixels > 0) {
+      std::pair<int, int> const scales[] = {{8, cv::IMREAD_REDUCED_COLOR_8},
+                                            {4, cv::IMREAD_REDUCED_COLOR_4},
+                                            {2, cv::IMREAD_REDUCED_COLOR_2}};
+      for (auto [scale, flag] : scales) {
+        long w = size->first / scale;
+        long h = size->second / scale;
+        if (w * h >= minPixels) {
+          return cv::imread(imageFile, flag);
+        }
+      }
+    }
+    // JPEG 没有透明通道
+    return cv::imread(imageFile, cv::IMREAD_COLOR);
+  }
+
+  // 保留透明通道
+  auto image = cv::imread(imageFile, cv::IMREAD_UNCHANGED);
+  if (!image.empty() && image.channels() != 1 && image.channels() != 3 &&
+      image.channels() != 4) {
+    image = cv::imread(imageFile, cv::IMREAD_COLOR);
+  }
+  return image;
+}
 
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
+  std::string error;
+  auto options = Cli::parseArgs(argc, argv, error);
+  if (!options) {
+    std::fprintf(stderr, "ink: %s\n", error.c_str());
     return 1;
   }
+  if (options->help) {
+    Cli::printUsage(stdout);
+    return 0;
+  }
 
-  std::string imageFile = argv[1];
+  // 大图像可放在文件中, 由系统换页
+  setMapStorage(options->storage);
 
-  // 加载图像
-  cv::Mat image = cv::imread(imageFile);
-  if (image.empty()) {
-    return 1;
+  // 服务模式
+  if (!options->serveSocket.empty()) {
+    return Server::serve({options->serveSocket, options->pipeline.traceThreads,
+                          options->pipeline.queueDepth,
+                          options->pipeline.verbose});
   }
 
-  // 转换为RgbMap
-  auto rgbmap = matToRgbMap(image);
-
-  auto engine = std::make_unique<PotraceTracingEngine>(
-      TraceType::QUANT,  // 颜色量化
-      false,  // 是否反转
-      4,  // 颜色量化数量
-      0.45,  // 亮度阈值
-      0.0,  // 亮度阈值
-      0.55,  // 亮度阈值
-      2,  // 多扫描颜色数量
-      true,  // 多扫描堆叠
-      false,  // 多扫描平滑
-      false  // 多扫描移除背景
-    );
-
-  auto traceResult = trace(std::move(engine), rgbmap);
-
-  if (traceResult.items.empty()) {
+  auto jobs = Cli::collectJobs(*options, error);
+  if (!jobs) {
+    std::fprintf(stderr, "ink: %s\n", error.c_str());
     return 1;
   }
+  if (jobs->empty()) {
+    Cli::printUsage(stderr);
+    return 1;
+  }
+
+  // 加载图像并转换为RgbMap
+  auto decode = [](std::string const &imageFile, long minPixels)
+      -> std::optional<Cli::DecodedImage> {
+    cv::Mat image = decodeReduced(imageFile, minPixels);
+    if (image.empty()) {
+      return {};
+    }
+    return Cli::DecodedImage{matToRgbMap(image), image.cols, image.rows};
+  };
+
+  auto engineOptions = options->engine;
+  auto makeEngine = [&engineOptions]() -> std::unique_ptr<TracingEngine> {
+    return Cli::makeEngine(engineOptions);
+  };
 
-  // 使用新的 TraceResult 内置方法直接保存 SVG！
-  traceResult.saveToSvg("output.svg", image.cols, image.rows);
+  auto stats = Cli::runPipeline(*jobs, decode, makeEngine, options->pipeline);
 
-  return 0;
+  return stats.failed == 0 ? 0 : 1;
 }
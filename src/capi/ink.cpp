@@ -0,0 +1,432 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * C interface of libink, for tracing in-process without files or a
+ * process per image.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#include "capi/ink.h"
+#include "engines/engines.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <new>
+#include <string>
+
+struct ink_engine {
+  std::unique_ptr<TracingEngine> engine;
+};
+
+struct ink_image {
+  RgbPyramid pyramid;
+};
+
+struct ink_result {
+  TraceResult result;
+  int width;
+  int height;
+  std::string svg;
+};
+
+namespace {
+
+thread_local std::string lastError;
+
+void setError(char const *message) { lastError = message; }
+
+// 合成到白色背景上
+unsigned char overWhite(unsigned char value, unsigned char alpha) {
+  return (value * alpha + 255 * (255 - alpha) + 127) / 255;
+}
+
+// 调用方缓冲区转 RgbMap
+RgbMap bufferToRgbMap(unsigned char const *pixels, int width, int height,
+                      ptrdiff_t stride, ink_pixel_format format) {
+  auto rgbmap = RgbMap(width, height);
+  bool const withAlpha = format == INK_PIXEL_RGBA || format == INK_PIXEL_BGRA;
+  if (withAlpha) {
+    rgbmap.alpha.resize((size_t)width * height);
+  }
+
+  for (int y = 0; y < height; y++) {
+    auto src = pixels + y * stride;
+    auto dst = rgbmap.row(y);
+    if (withAlpha) {
+      // 保留不透明度, 用于跳过完全透明的区域
+      auto alpha = rgbmap.alpha.data() + rgbmap.offset(0, y);
+      for (int x = 0; x < width; x++) {
+        alpha[x] = src[4 * x + 3];
+      }
+    }
+    for (int x = 0; x < width; x++) {
+      switch (format) {
+      case INK_PIXEL_RGB:
+        dst[x] = {src[0], src[1], src[2]};
+        src += 3;
+        break;
+      case INK_PIXEL_BGR:
+        dst[x] = {src[2], src[1], src[0]};
+        src += 3;
+        break;
+      case INK_PIXEL_RGBA:
+        dst[x] = {overWhite(src[0], src[3]), overWhite(src[1], src[3]),
+                  overWhite(src[2], src[3])};
+        src += 4;
+        break;
+      case INK_PIXEL_BGRA:
+        dst[x] = {overWhite(src[2], src[3]), overWhite(src[1], src[3]),
+                  overWhite(src[0], src[3])};
+        src += 4;
+        break;
+      case INK_PIXEL_GRAY:
+        dst[x] = {src[0], src[0], src[0]};
+        src += 1;
+        break;
+      }
+    }
+  }
+
+  // 全不透明时不必保留
+  if (withAlpha && std::all_of(rgbmap.alpha.begin(), rgbmap.alpha.end(),
+                               [](unsigned char a) { return a == 255; })) {
+    rgbmap.alpha.clear();
+  }
+
+  return rgbmap;
+}
+
+// 0..1 的比例
+bool isFraction(double value) { return value >= 0.0 && value <= 1.0; }
+
+// 负值表示沿用 potrace 默认值
+bool isOptional(double value) { return value < 0.0 || std::isfinite(value); }
+
+/**
+ * Check parameters before they reach the engines, which assert on or
+ * misbehave with values out of range. Returns the error message, or null.
+ */
+char const *checkParams(ink_params const &p) {
+  if ((p.trace_type < INK_TRACE_BRIGHTNESS || p.trace_type > INK_TRACE_QUANT_MONO) &&
+      p.trace_type != INK_TRACE_CENTERLINE) {
+    return "ink_engine_new: unknown trace type";
+  }
+  if (p.quantization_colors < 1 || p.quantization_colors > 256 ||
+      p.multiscan_colors < 1 || p.multiscan_colors > 256) {
+    return "ink_engine_new: color counts must be within 1..256";
+  }
+  if (!isFraction(p.brightness_threshold) || !isFraction(p.brightness_floor) ||
+      !isFraction(p.canny_threshold)) {
+    return "ink_engine_new: thresholds must be within 0..1";
+  }
+  if (!isOptional(p.alphamax) || !isOptional(p.opttolerance)) {
+    return "ink_engine_new: alphamax and opttolerance must be finite";
+  }
+  if (p.threads < 0) {
+    return "ink_engine_new: negative thread count";
+  }
+  return nullptr;
+}
+
+int bytesPerPixel(ink_pixel_format format) {
+  switch (format) {
+  case INK_PIXEL_RGB:
+  case INK_PIXEL_BGR:
+    return 3;
+  case INK_PIXEL_RGBA:
+  case INK_PIXEL_BGRA:
+    return 4;
+  case INK_PIXEL_GRAY:
+    return 1;
+  }
+  return 0;
+}
+
+} // namespace
+
+extern "C" {
+
+int ink_version(void) { return INK_API_VERSION; }
+
+const char *ink_last_error(void) { return lastError.c_str(); }
+
+void ink_params_init(ink_params *params) {
+  if (!params) {
+    return;
+  }
+  std::memset(params, 0, sizeof(*params));
+  params->struct_size = sizeof(*params);
+
+  // 与命令行默认值一致
+  params->trace_type = INK_TRACE_QUANT;
+  params->invert = 0;
+  params->quantization_colors = 4;
+  params->brightness_threshold = 0.45;
+  params->brightness_floor = 0.0;
+  params->canny_threshold = 0.55;
+  params->multiscan_colors = 2;
+  params->multiscan_stack = 1;
+  params->multiscan_smooth = 0;
+  params->multiscan_remove_background = 0;
+
+  params->turdsize = -1;
+  params->alphamax = -1.0;
+  params->opticurve = -1;
+  params->opttolerance = -1.0;
+
+  params->threads = 1;
+}
+
+ink_engine *ink_engine_new(const ink_params *given) {
+  size_t constexpr MIN_SIZE = offsetof(ink_params, trace_type) + sizeof(int);
+  if (!given || given->struct_size < MIN_SIZE) {
+    setError("ink_engine_new: parameters not set up by ink_params_init");
+    return nullptr;
+  }
+  // 旧版本的调用方只填了前面的成员, 其余取默认值
+  ink_params local;
+  ink_params_init(&local);
+  std::memcpy(&local, given, std::min(given->struct_size, sizeof(ink_params)));
+  auto const params = &local;
+  if (auto error = checkParams(*params)) {
+    setError(error);
+    return nullptr;
+  }
+
+  try {
+    if (params->trace_type == INK_TRACE_CENTERLINE) {
+      auto engine = std::make_unique<Centerline::CenterlineTracingEngine>(
+          params->brightness_threshold, params->invert);
+      engine->setThreads(params->threads);
+      return new ink_engine{std::move(engine)};
+    }
+
+    auto engine = std::make_unique<Potrace::PotraceTracingEngine>(
+        static_cast<TraceType>(params->trace_type), params->invert,
+        params->quantization_colors, params->brightness_threshold,
+        params->brightness_floor, params->canny_threshold,
+        params->multiscan_colors, params->multiscan_stack,
+        params->multiscan_smooth, params->multiscan_remove_background);
+
+    if (params->turdsize >= 0) {
+      engine->setTurdSize(params->turdsize);
+    }
+    if (params->alphamax >= 0.0) {
+      engine->setAlphaMax(params->alphamax);
+    }
+    if (params->opticurve >= 0) {
+      engine->setOptiCurve(params->opticurve);
+    }
+    if (params->opttolerance >= 0.0) {
+      engine->setOptTolerance(params->opttolerance);
+    }
+    QuantizeOptions quantize;
+    quantize.nrThreads = params->threads;
+    engine->setQuantizeOptions(quantize);
+    engine->setTraceThreads(params->threads);
+
+    return new ink_engine{std::move(engine)};
+  } catch (std::exception const &e) {
+    setError(e.what());
+    return nullptr;
+  }
+}
+
+void ink_engine_free(ink_engine *engine) { delete engine; }
+
+ink_result *ink_trace(ink_engine *engine, const unsigned char *pixels,
+                      int width, int height, ptrdiff_t stride,
+                      ink_pixel_format format) {
+  if (!engine || !pixels) {
+    setError("ink_trace: null engine or pixels");
+    return nullptr;
+  }
+  int const bpp = bytesPerPixel(format);
+  if (bpp == 0) {
+    setError("ink_trace: unknown pixel format");
+    return nullptr;
+  }
+  if (width <= 0 || height <= 0 || stride < (ptrdiff_t)width * bpp) {
+    setError("ink_trace: bad image size or stride");
+    return nullptr;
+  }
+
+  try {
+    auto rgbmap = bufferToRgbMap(pixels, width, height, stride, format);
+    return new ink_result{engine->engine->trace(rgbmap), width, height, {}};
+  } catch (std::bad_alloc const &) {
+    setError("ink_trace: out of memory");
+    return nullptr;
+  } catch (std::exception const &e) {
+    setError(e.what());
+    return nullptr;
+  }
+}
+
+ink_image *ink_image_new(const unsigned char *pixels, int width, int height,
+                         ptrdiff_t stride, ink_pixel_format format) {
+  if (!pixels) {
+    setError("ink_image_new: null pixels");
+    return nullptr;
+  }
+  int const bpp = bytesPerPixel(format);
+  if (bpp == 0) {
+    setError("ink_image_new: unknown pixel format");
+    return nullptr;
+  }
+  if (width <= 0 || height <= 0 || stride < (ptrdiff_t)width * bpp) {
+    setError("ink_image_new: bad image size or stride");
+    return nullptr;
+  }
+
+  try {
+    return new ink_image{
+        RgbPyramid(bufferToRgbMap(pixels, width, height, stride, format))};
+  } catch (std::exception const &e) {
+    setError(e.what());
+    return nullptr;
+  }
+}
+
+void ink_image_free(ink_image *image) { delete image; }
+
+ink_result *ink_trace_image(ink_engine *engine, ink_image *image) {
+  if (!engine || !image) {
+    setError("ink_trace_image: null engine or image");
+    return nullptr;
+  }
+
+  try {
+    auto const &rgbmap = image->pyramid.level(0);
+    return new ink_result{engine->engine->trace(rgbmap), rgbmap.width,
+                          rgbmap.height, {}};
+  } catch (std::exception const &e) {
+    setError(e.what());
+    return nullptr;
+  }
+}
+
+int ink_trace_stream(ink_engine *engine, ink_image *image, ink_item_fn item,
+                     void *user) {
+  if (!engine || !image || !item) {
+    setError("ink_trace_stream: null engine, image or callback");
+    return -1;
+  }
+
+  try {
+    engine->engine->traceStream(
+        image->pyramid.level(0), [&](TraceResultItem &&result) {
+          item(result.style.c_str(), result.pathData.c_str(), user);
+        });
+    return 0;
+  } catch (std::exception const &e) {
+    setError(e.what());
+    return -1;
+  }
+}
+
+ink_result *ink_trace_progressive(ink_engine *engine, ink_image *image,
+                                  long coarse_pixels, ink_progress_fn progress,
+                                  void *user) {
+  if (!engine || !image) {
+    setError("ink_trace_progressive: null engine or image");
+    return nullptr;
+  }
+
+  try {
+    auto const &rgbmap = image->pyramid.level(0);
+    ProgressiveOptions options;
+    if (coarse_pixels > 0) {
+      options.coarsePixels = coarse_pixels;
+    }
+    auto onResult = [&](TraceResult const &result, bool final) {
+      if (progress) {
+        ink_result partial{result, rgbmap.width, rgbmap.height, {}};
+        progress(&partial, final, user);
+      }
+    };
+    return new ink_result{
+        engine->engine->traceProgressive(rgbmap, onResult, options),
+        rgbmap.width, rgbmap.height, {}};
+  } catch (std::exception const &e) {
+    setError(e.what());
+    return nullptr;
+  }
+}
+
+int ink_preview(ink_engine *engine, ink_image *image, long min_pixels,
+                double max_millis, unsigned char **rgb, int *width,
+                int *height) {
+  if (!engine || !image || !rgb || !width || !height) {
+    setError("ink_preview: null argument");
+    return -1;
+  }
+
+  try {
+    auto preview =
+        engine->engine->previewScaled(image->pyramid, {min_pixels, max_millis});
+    size_t const size = (size_t)preview.width * preview.height * 3;
+    auto out = static_cast<unsigned char *>(std::malloc(size ? size : 1));
+    if (!out) {
+      setError("ink_preview: out of memory");
+      return -1;
+    }
+    for (size_t i = 0; i < preview.pixels.size(); i++) {
+      out[3 * i] = preview.pixels[i].r;
+      out[3 * i + 1] = preview.pixels[i].g;
+      out[3 * i + 2] = preview.pixels[i].b;
+    }
+    *rgb = out;
+    *width = preview.width;
+    *height = preview.height;
+    return 0;
+  } catch (std::exception const &e) {
+    setError(e.what());
+    return -1;
+  }
+}
+
+void ink_free(void *memory) { std::free(memory); }
+
+size_t ink_result_count(const ink_result *result) {
+  return result ? result->result.items.size() : 0;
+}
+
+const char *ink_result_style(const ink_result *result, size_t index) {
+  if (!result || index >= result->result.items.size()) {
+    return nullptr;
+  }
+  return result->result.items[index].style.c_str();
+}
+
+const char *ink_result_path(const ink_result *result, size_t index) {
+  if (!result || index >= result->result.items.size()) {
+    return nullptr;
+  }
+  return result->result.items[index].pathData.c_str();
+}
+
+const char *ink_result_svg(ink_result *result) {
+  if (!result) {
+    return nullptr;
+  }
+  try {
+    if (result->svg.empty()) {
+      result->svg = result->result.toSvg(result->width, result->height);
+    }
+    return result->svg.c_str();
+  } catch (std::exception const &e) {
+    setError(e.what());
+    return nullptr;
+  }
+}
+
+void ink_result_free(ink_result *result) { delete result; }
+
+} // extern "C"
@@ -0,0 +1,452 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Command line options of the ink binary.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#include "cli/options.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <climits>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace Cli {
+
+namespace {
+
+// 线程数上限
+int constexpr MAX_THREADS = 1024;
+
+// 可识别的图像扩展名 (目录展开时使用)
+char const *const IMAGE_EXTENSIONS[] = {".png", ".jpg", ".jpeg", ".bmp",
+                                        ".tif", ".tiff", ".webp", ".pbm",
+                                        ".pgm", ".ppm", ".pnm"};
+
+bool isImageFile(fs::path const &path) {
+  auto ext = path.extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  for (auto known : IMAGE_EXTENSIONS) {
+    if (ext == known) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T> struct Choice {
+  char const *name;
+  T value;
+};
+
+Choice<TraceType> const TRACE_TYPES[] = {
+    {"brightness", TraceType::BRIGHTNESS},
+    {"brightness-multi", TraceType::BRIGHTNESS_MULTI},
+    {"canny", TraceType::CANNY},
+    {"quant", TraceType::QUANT},
+    {"quant-color", TraceType::QUANT_COLOR},
+    {"quant-mono", TraceType::QUANT_MONO},
+    {"centerline", TraceType::AUTOTRACE_CENTERLINE},
+};
+
+Choice<QuantizeMethod> const QUANTIZE_METHODS[] = {
+    {"octree", QuantizeMethod::OCTREE},
+    {"median-cut", QuantizeMethod::MEDIAN_CUT},
+};
+
+Choice<QuantizeSpace> const QUANTIZE_SPACES[] = {
+    {"rgb", QuantizeSpace::RGB},
+    {"oklab", QuantizeSpace::OKLAB},
+};
+
+Choice<PaletteSampling> const PALETTE_SAMPLINGS[] = {
+    {"full", PaletteSampling::FULL},
+    {"strided", PaletteSampling::STRIDED},
+    {"stratified", PaletteSampling::STRATIFIED},
+    {"mipmap", PaletteSampling::MIPMAP},
+};
+
+template <typename T, size_t N>
+bool parseChoice(std::string const &text, Choice<T> const (&choices)[N],
+                 T &out) {
+  for (auto const &c : choices) {
+    if (text == c.name) {
+      out = c.value;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool parseInt(std::string const &text, int &out) {
+  try {
+    size_t end;
+    out = std::stoi(text, &end);
+    return end == text.size();
+  } catch (...) {
+    return false;
+  }
+}
+
+bool parseDouble(std::string const &text, double &out) {
+  try {
+    size_t end;
+    out = std::stod(text, &end);
+    return end == text.size();
+  } catch (...) {
+    return false;
+  }
+}
+
+// 带范围检查的版本
+bool parseInt(std::string const &text, int &out, int min, int max = INT_MAX) {
+  int n;
+  if (!parseInt(text, n) || n < min || n > max) {
+    return false;
+  }
+  out = n;
+  return true;
+}
+
+bool parseDouble(std::string const &text, double &out, double min, double max = DBL_MAX) {
+  double d;
+  if (!parseDouble(text, d) || !(d >= min && d <= max)) {
+    return false;
+  }
+  out = d;
+  return true;
+}
+
+// 读取清单: 每行一个路径, 忽略空行
+bool readList(std::string const &name, std::vector<std::string> &out) {
+  std::ifstream file;
+  std::istream *in = &std::cin;
+  if (name != "-") {
+    file.open(name);
+    if (!file) {
+      return false;
+    }
+    in = &file;
+  }
+  std::string line;
+  while (std::getline(*in, line)) {
+    while (!line.empty() && std::isspace((unsigned char)line.back())) {
+      line.pop_back();
+    }
+    if (!line.empty()) {
+      out.push_back(line);
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+std::optional<CliOptions> parseArgs(int argc, char **argv,
+                                    std::string &error) {
+  CliOptions options;
+  auto &engine = options.engine;
+  auto &pipeline = options.pipeline;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.size() < 2 || arg[0] != '-' || arg == "-") {
+      options.inputs.push_back(arg);
+      continue;
+    }
+
+    // --name=value 或 --name value
+    std::string name = arg;
+    std::optional<std::string> inlineValue;
+    if (auto eq = arg.find('='); eq != std::string::npos) {
+      name = arg.substr(0, eq);
+      inlineValue = arg.substr(eq + 1);
+    }
+    bool missing = false;
+    auto value = [&]() -> std::string {
+      if (inlineValue) {
+        return *inlineValue;
+      }
+      if (i + 1 < argc) {
+        return argv[++i];
+      }
+      missing = true;
+      return {};
+    };
+
+    bool ok = true;
+    int n;
+    double d;
+
+    if (name == "-h" || name == "--help") {
+      options.help = true;
+    } else if (name == "-o" || name == "--output") {
+      options.output = value();
+    } else if (name == "-l" || name == "--list") {
+      options.lists.push_back(value());
+    } else if (name == "--serve") {
+      options.serveSocket = value();
+    } else if (name == "-v" || name == "--verbose") {
+      pipeline.verbose = true;
+    } else if (name == "--type") {
+      ok = parseChoice(value(), TRACE_TYPES, engine.traceType);
+    } else if (name == "--invert") {
+      engine.invert = true;
+    } else if (name == "--colors") {
+      ok = parseInt(value(), engine.quantizationNrColors, 1, 256);
+    } else if (name == "--threshold") {
+      ok = parseDouble(value(), engine.brightnessThreshold, 0.0, 1.0);
+    } else if (name == "--floor") {
+      ok = parseDouble(value(), engine.brightnessFloor, 0.0, 1.0);
+    } else if (name == "--canny-threshold") {
+      ok = parseDouble(value(), engine.cannyHighThreshold, 0.0, 1.0);
+    } else if (name == "--scans") {
+      ok = parseInt(value(), engine.multiScanNrColors, 1, 256);
+    } else if (name == "--no-stack") {
+      engine.multiScanStack = false;
+    } else if (name == "--smooth") {
+      engine.multiScanSmooth = true;
+    } else if (name == "--remove-background") {
+      engine.multiScanRemoveBackground = true;
+    } else if (name == "--turdsize") {
+      ok = parseInt(value(), n, 0) && (engine.turdSize = n, true);
+    } else if (name == "--alphamax") {
+      ok = parseDouble(value(), d, 0.0) && (engine.alphaMax = d, true);
+    } else if (name == "--no-opticurve") {
+      engine.optiCurve = false;
+    } else if (name == "--opttolerance") {
+      ok = parseDouble(value(), d, 0.0) && (engine.optTolerance = d, true);
+    } else if (name == "--quantize") {
+      ok = parseChoice(value(), QUANTIZE_METHODS, engine.quantize.method);
+    } else if (name == "--color-space") {
+      ok = parseChoice(value(), QUANTIZE_SPACES, engine.quantize.space);
+    } else if (name == "--sampling") {
+      ok = parseChoice(value(), PALETTE_SAMPLINGS, engine.quantize.sampling);
+    } else if (name == "--sample-budget") {
+      ok = parseInt(value(), engine.quantize.sampleBudget, 1);
+    } else if (name == "--refine") {
+      ok = parseInt(value(), engine.quantize.refineIterations, 0);
+    } else if (name == "--refine-step") {
+      ok = parseInt(value(), engine.quantize.refineSampleStep, 1);
+    } else if (name == "--despeckle") {
+      ok = parseInt(value(), n, 0) && (engine.cleanup.minArea = n, true);
+    } else if (name == "--open") {
+      ok = parseInt(value(), engine.cleanup.open, 0);
+    } else if (name == "--close") {
+      ok = parseInt(value(), engine.cleanup.close, 0);
+    } else if (name == "--image-threads") {
+      ok = parseInt(value(), engine.traceThreads, 0, MAX_THREADS);
+      engine.quantize.nrThreads = engine.traceThreads;
+    } else if (name == "-j" || name == "--jobs") {
+      ok = parseInt(value(), pipeline.traceThreads, 0, MAX_THREADS);
+    } else if (name == "--decode-threads") {
+      ok = parseInt(value(), pipeline.decodeThreads, 0, MAX_THREADS);
+    } else if (name == "--write-threads") {
+      ok = parseInt(value(), pipeline.writeThreads, 0, MAX_THREADS);
+    } else if (name == "--preview") {
+      ok = parseInt(value(), n) && n > 0 && (pipeline.previewPixels = n, true);
+    } else if (name == "--queue") {
+      ok = parseInt(value(), pipeline.queueDepth, 1);
+    } else if (name == "--spill") {
+      options.storage.directory = value();
+    } else if (name == "--spill-min") {
+      ok = parseInt(value(), n) && n >= 0 &&
+           (options.storage.minBytes = (size_t)n << 20, true);
+    } else {
+      error = "unknown option " + name;
+      return {};
+    }
+
+    if (missing) {
+      error = "missing value for " + name;
+      return {};
+    }
+    if (!ok) {
+      error = "bad value for " + name;
+      return {};
+    }
+  }
+
+  return options;
+}
+
+std::optional<std::vector<BatchJob>> collectJobs(CliOptions const &options,
+                                                 std::string &error) {
+  std::vector<std::string> files;
+  for (auto const &input : options.inputs) {
+    std::error_code ec;
+    if (fs::is_directory(input, ec)) {
+      std::vector<std::string> found;
+      for (auto const &entry : fs::directory_iterator(input, ec)) {
+        if (entry.is_regular_file(ec) && isImageFile(entry.path())) {
+          found.push_back(entry.path().string());
+        }
+      }
+      std::sort(found.begin(), found.end());
+      files.insert(files.end(), found.begin(), found.end());
+    } else {
+      files.push_back(input);
+    }
+  }
+  for (auto const &list : options.lists) {
+    if (!readList(list, files)) {
+      error = "cannot read list " + list;
+      return {};
+    }
+  }
+
+  std::vector<BatchJob> jobs;
+  if (files.empty()) {
+    return jobs;
+  }
+
+  bool const preview = options.pipeline.previewPixels > 0;
+
+  // 单个图像: 保持原先的输出方式
+  bool const single = files.size() == 1 && options.lists.empty() &&
+                      !fs::is_directory(options.inputs.front());
+  if (single && !fs::is_directory(options.output)) {
+    auto output = !options.output.empty() ? options.output
+                  : preview                  ? "preview.ppm"
+                                             : "output.svg";
+    jobs.push_back({files.front(), output});
+  } else {
+    fs::path dir = options.output.empty() ? "." : options.output;
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (!fs::is_directory(dir)) {
+      error = "cannot create output directory " + dir.string();
+      return {};
+    }
+    // 预览另用后缀, 免得与 .ppm 输入同名
+    for (auto const &file : files) {
+      auto output = dir / fs::path(file).filename().replace_extension(
+                              preview ? ".preview.ppm" : ".svg");
+      jobs.push_back({file, output.string()});
+    }
+  }
+
+  // 输出不得覆盖输入: 解码线程可能仍在读它
+  std::error_code ec;
+  std::set<fs::path> inputs;
+  for (auto const &job : jobs) {
+    inputs.insert(fs::weakly_canonical(job.input, ec));
+  }
+  // 也不得重名 (a/x.png 与 b/x.png, x.png 与 x.jpg), 否则写线程互相覆盖
+  std::map<fs::path, std::string const *> outputs;
+  for (auto const &job : jobs) {
+    auto output = fs::weakly_canonical(job.output, ec);
+    if (inputs.count(output)) {
+      error = "output " + job.output + " would overwrite an input";
+      return {};
+    }
+    auto [other, added] = outputs.emplace(output, &job.input);
+    if (!added) {
+      error = *other->second + " and " + job.input + " would both write " + job.output;
+      return {};
+    }
+  }
+  return jobs;
+}
+
+std::unique_ptr<TracingEngine> makeEngine(EngineOptions const &options) {
+  if (options.traceType == TraceType::AUTOTRACE_CENTERLINE) {
+    auto engine = std::make_unique<Centerline::CenterlineTracingEngine>(
+        options.brightnessThreshold, options.invert);
+    engine->setThreads(options.traceThreads);
+    return engine;
+  }
+
+  auto engine = std::make_unique<Potrace::PotraceTracingEngine>(
+      options.traceType, options.invert, options.quantizationNrColors,
+      options.brightnessThreshold, options.brightnessFloor,
+      options.cannyHighThreshold, options.multiScanNrColors,
+      options.multiScanStack, options.multiScanSmooth,
+      options.multiScanRemoveBackground);
+
+  if (options.turdSize) {
+    engine->setTurdSize(*options.turdSize);
+  }
+  if (options.alphaMax) {
+    engine->setAlphaMax(*options.alphaMax);
+  }
+  if (options.optiCurve) {
+    engine->setOptiCurve(*options.optiCurve);
+  }
+  if (options.optTolerance) {
+    engine->setOptTolerance(*options.optTolerance);
+  }
+  engine->setQuantizeOptions(options.quantize);
+  engine->setTraceThreads(options.traceThreads);
+  if (options.cleanup.enabled()) {
+    engine->setBitmapCleanup(options.traceType, options.cleanup);
+  }
+
+  return engine;
+}
+
+void printUsage(std::FILE *out) {
+  std::fputs(
+      "usage: ink [options] <image|directory>... [-l list]\n"
+      "\n"
+      "input / output:\n"
+      "  -o, --output PATH        output file (one image) or directory\n"
+      "  -l, --list FILE          read image paths from FILE, '-' for stdin\n"
+      "  -v, --verbose            report every traced file or request\n"
+      "  --serve SOCKET           run as a trace server on a Unix socket,\n"
+      "                           -j requests at once, --queue waiting\n"
+      "\n"
+      "tracing:\n"
+      "  --type TYPE              brightness, brightness-multi, canny,\n"
+      "                           quant (default), quant-color, quant-mono,\n"
+      "                           centerline (open strokes for line art)\n"
+      "  --invert                 invert the image\n"
+      "  --colors N               quantization colors (4)\n"
+      "  --threshold X            brightness threshold (0.45)\n"
+      "  --floor X                brightness floor (0.0)\n"
+      "  --canny-threshold X      canny high threshold (0.55)\n"
+      "  --scans N                multiple scan colors (2)\n"
+      "  --no-stack               do not stack multiple scans\n"
+      "  --smooth                 smooth before multiple scans\n"
+      "  --remove-background      drop the bottom-most scan\n"
+      "  --turdsize N             suppress specks of up to N pixels\n"
+      "  --alphamax X             corner threshold\n"
+      "  --no-opticurve           do not join curve segments\n"
+      "  --opttolerance X         curve optimization tolerance\n"
+      "  --despeckle N            remove specks and holes under N pixels\n"
+      "  --open N, --close N      morphological cleanup steps\n"
+      "\n"
+      "quantization:\n"
+      "  --quantize METHOD        octree (default), median-cut\n"
+      "  --color-space SPACE      rgb (default), oklab\n"
+      "  --sampling MODE          full (default), strided, stratified, mipmap\n"
+      "  --sample-budget N        pixels sampled for the palette\n"
+      "  --refine N               k-means refinement iterations\n"
+      "  --refine-step N          pixel step of the refinement\n"
+      "\n"
+      "pipeline:\n"
+      "  -j, --jobs N             images traced at once (0: one per core)\n"
+      "  --image-threads N        threads used within one image (1)\n"
+      "  --decode-threads N       decoding threads (2)\n"
+      "  --write-threads N        writing threads (1)\n"
+      "  --queue N                images waiting between stages (4)\n"
+      "  --preview N              write PPM previews of at least N pixels\n"
+      "                           (<stem>.preview.ppm) instead of tracing\n"
+      "  --spill DIR              keep large images in files under DIR,\n"
+      "                           paged by the OS instead of held in RAM\n"
+      "  --spill-min MB           smallest image buffer to spill (64)\n",
+      out);
+}
+
+} // namespace Cli
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Batch tracing with decode, trace and write overlapped across files.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#include "cli/pipeline.h"
+#include "core/parallel/parallel.h"
+#include "core/parallel/queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+namespace Cli {
+
+namespace {
+
+// 解码完成, 等待追踪
+struct Decoded {
+  int job;
+  DecodedImage image;
+};
+
+// 追踪完成, 等待写出
+struct Traced {
+  int job;
+  TraceResult result;
+  int width;
+  int height;
+  std::unique_ptr<RgbMap> preview; // 预览模式下代替 result
+};
+
+/**
+ * Run fn on <count> threads; the last one to finish calls done(), which is
+ * how each stage closes the queue feeding the next.
+ */
+template <typename F, typename D>
+void startStage(std::vector<std::thread> &threads, int count, F fn, D done) {
+  auto remaining = std::make_shared<std::atomic<int>>(count);
+  for (int i = 0; i < count; i++) {
+    threads.emplace_back([fn, done, remaining] {
+      fn();
+      if (--*remaining == 0) {
+        done();
+      }
+    });
+  }
+}
+
+} // namespace
+
+BatchStats runPipeline(std::vector<BatchJob> const &jobs,
+                       ImageDecoder const &decode,
+                       EngineFactory const &makeEngine,
+                       PipelineOptions const &options) {
+  int const nrJobs = jobs.size();
+  if (nrJobs == 0) {
+    return {};
+  }
+  int const decodeThreads =
+      std::min(Parallel::threadCount(options.decodeThreads), nrJobs);
+  int const traceThreads =
+      std::min(Parallel::threadCount(options.traceThreads), nrJobs);
+  int const writeThreads =
+      std::min(Parallel::threadCount(options.writeThreads), nrJobs);
+
+  Parallel::BoundedQueue<Decoded> decoded(options.queueDepth);
+  Parallel::BoundedQueue<Traced> traced(options.queueDepth);
+  std::atomic<int> nextJob{0};
+  std::atomic<int> nrTraced{0};
+  std::atomic<int> nrFailed{0};
+
+  auto fail = [&](int job, char const *reason) {
+    std::fprintf(stderr, "ink: %s: %s\n", jobs[job].input.c_str(), reason);
+    nrFailed++;
+  };
+
+  // 单个文件出错 (内存不足, 解码异常等) 只算它失败
+  auto guarded = [&](int job, auto &&step) {
+    try {
+      step();
+    } catch (std::exception const &e) {
+      fail(job, e.what());
+    }
+  };
+
+  std::vector<std::thread> threads;
+
+  // 解码
+  startStage(
+      threads, decodeThreads,
+      [&] {
+        for (int job = nextJob++; job < nrJobs; job = nextJob++) {
+          guarded(job, [&] {
+            auto image = decode(jobs[job].input, options.previewPixels);
+            if (!image) {
+              fail(job, "cannot read image");
+              return;
+            }
+            decoded.push({job, std::move(*image)});
+          });
+        }
+      },
+      [&] { decoded.close(); });
+
+  // 追踪: 所有线程共享一个引擎
+  auto const engine = makeEngine();
+  startStage(
+      threads, traceThreads,
+      [&] {
+        while (auto item = decoded.pop()) {
+          guarded(item->job, [&] {
+            if (options.previewPixels > 0) {
+              RgbPyramid pyramid(std::move(item->image.rgbmap), 1);
+              auto preview =
+                  engine->previewScaled(pyramid, {options.previewPixels, 0});
+              traced.push({item->job, {}, preview.width, preview.height,
+                           std::make_unique<RgbMap>(std::move(preview))});
+              return;
+            }
+            auto result = engine->trace(item->image.rgbmap);
+            if (result.items.empty()) {
+              fail(item->job, "nothing to trace");
+              return;
+            }
+            traced.push({item->job, std::move(result), item->image.width,
+                         item->image.height, nullptr});
+          });
+        }
+      },
+      [&] { traced.close(); });
+
+  // 写出
+  startStage(
+      threads, writeThreads,
+      [&] {
+        while (auto item = traced.pop()) {
+          guarded(item->job, [&] {
+            auto const &job = jobs[item->job];
+            bool written;
+            if (item->preview) {
+              written = item->preview->writePPM(job.output.c_str());
+            } else {
+              std::ofstream file(job.output);
+              file << item->result.toSvg(item->width, item->height);
+              file.close();
+              written = bool(file);
+            }
+            if (!written) {
+              fail(item->job, "cannot write output");
+              return;
+            }
+            nrTraced++;
+            if (options.verbose) {
+              std::fprintf(stderr, "%s -> %s\n", job.input.c_str(),
+                           job.output.c_str());
+            }
+          });
+        }
+      },
+      [] {});
+
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  return {nrTraced, nrFailed};
+}
+
+} // namespace Cli
@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Hot inner loops, built for several instruction sets and picked at run time.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#include "core/cpu/kernels.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define INK_KERNELS_X86 1
+#endif
+
+namespace Kernels {
+
+namespace {
+
+/*
+ * The loops are written once and forced inline into one wrapper per
+ * instruction set, so each copy is vectorized for the target of its
+ * wrapper.
+ */
+
+#define INK_KERNEL_BODY [[gnu::always_inline]] inline
+
+template <int N>
+INK_KERNEL_BODY void gaussBody(unsigned char const *const *lines, int n, unsigned char *dst)
+{
+    // a constant count lets whole blocks vectorize without a tail
+    if (N) {
+        n = N;
+    }
+    // sums are at most 159 * 255, 16 bits are enough
+    uint16_t sum[GAUSS_BLOCK] = {};
+    for (int i = 0; i < 5; i++) {
+        auto line = lines[i] - 2;
+        // constant weights fold into the loop
+        int const *w = GAUSS_WEIGHTS + 5 * i;
+        for (int x = 0; x < n; x++) {
+            sum[x] += w[0] * line[x] + w[1] * line[x + 1] + w[2] * line[x + 2] +
+                      w[3] * line[x + 3] + w[4] * line[x + 4];
+        }
+    }
+    for (int x = 0; x < n; x++) {
+        dst[x] = sum[x] / 159;
+    }
+}
+
+INK_KERNEL_BODY void gaussBlock(unsigned char const *const *lines, int n, unsigned char *dst)
+{
+    if (n == GAUSS_BLOCK) {
+        gaussBody<GAUSS_BLOCK>(lines, n, dst);
+    } else {
+        gaussBody<0>(lines, n, dst);
+    }
+}
+
+INK_KERNEL_BODY void grayRow(RGB const *src, size_t n, unsigned long *dst)
+{
+    for (size_t i = 0; i < n; i++) {
+        unsigned sample = (unsigned)src[i].r + src[i].g + src[i].b;
+        dst[i] = sample * 255 / 256;
+    }
+}
+
+/*
+ * Palette entries are the outer loop, so the inner loop over pixels is
+ * branch free and maps onto SIMD lanes.
+ */
+INK_KERNEL_BODY void nearestColor(int const *pr, int const *pg, int const *pb, int size,
+                                  RGB const *rgbs, int n, unsigned *out)
+{
+    int r[COLOR_BATCH], g[COLOR_BATCH], b[COLOR_BATCH], dist[COLOR_BATCH];
+    unsigned index[COLOR_BATCH];
+    for (int i = 0; i < n; i++) {
+        r[i] = rgbs[i].r;
+        g[i] = rgbs[i].g;
+        b[i] = rgbs[i].b;
+        dist[i] = INT_MAX;
+        index[i] = 0;
+    }
+    for (int k = 0; k < size; k++) {
+        int const kr = pr[k], kg = pg[k], kb = pb[k];
+        for (int i = 0; i < n; i++) {
+            int dr = r[i] - kr, dg = g[i] - kg, db = b[i] - kb;
+            int d = dr * dr + dg * dg + db * db;
+            bool closer = d < dist[i];
+            dist[i] = closer ? d : dist[i];
+            index[i] = closer ? k : index[i];
+        }
+    }
+    std::copy(index, index + n, out);
+}
+
+#undef INK_KERNEL_BODY
+
+/// One set of wrappers per instruction set, <attrs> being its target.
+#define INK_KERNEL_VARIANT(name, attrs)                                                              \
+    namespace name {                                                                                 \
+    attrs void gaussBlock(unsigned char const *const *lines, int n, unsigned char *dst)               \
+    {                                                                                                \
+        Kernels::gaussBlock(lines, n, dst);                                                          \
+    }                                                                                                \
+    attrs void grayRow(RGB const *src, size_t n, unsigned long *dst)                                 \
+    {                                                                                                \
+        Kernels::grayRow(src, n, dst);                                                               \
+    }                                                                                                \
+    attrs void nearestColor(int const *r, int const *g, int const *b, int size,                      \
+                            RGB const *rgbs, int n, unsigned *out)                                   \
+    {                                                                                                \
+        Kernels::nearestColor(r, g, b, size, rgbs, n, out);                                          \
+    }                                                                                                \
+    }
+
+INK_KERNEL_VARIANT(Baseline, )
+#ifdef INK_KERNELS_X86
+INK_KERNEL_VARIANT(Avx2, [[gnu::target("avx2")]])
+INK_KERNEL_VARIANT(Avx512, [[gnu::target("avx512f,avx512bw")]])
+#endif
+
+#undef INK_KERNEL_VARIANT
+
+Table const tables[] = {
+    {Isa::BASELINE, Baseline::gaussBlock, Baseline::grayRow, Baseline::nearestColor},
+#ifdef INK_KERNELS_X86
+    {Isa::AVX2, Avx2::gaussBlock, Avx2::grayRow, Avx2::nearestColor},
+    {Isa::AVX512, Avx512::gaussBlock, Avx512::grayRow, Avx512::nearestColor},
+#endif
+};
+
+bool supported(Isa isa)
+{
+    switch (isa) {
+    case Isa::BASELINE:
+        return true;
+#ifdef INK_KERNELS_X86
+    case Isa::AVX2:
+        return __builtin_cpu_supports("avx2");
+    case Isa::AVX512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+    default:
+        return false;
+    }
+}
+
+Table const &choose()
+{
+#ifdef INK_KERNELS_X86
+    __builtin_cpu_init();
+#endif
+
+    Table const *best = &tables[0];
+    for (auto const &t : tables) {
+        if (supported(t.isa)) {
+            best = &t;
+        }
+    }
+
+    // forced, as long as it can run here; say so otherwise, benchmarks
+    // would quietly measure another variant
+    if (auto forced = std::getenv("INK_KERNELS")) {
+        for (auto const &t : tables) {
+            if (std::strcmp(forced, isaName(t.isa)) == 0 && supported(t.isa)) {
+                return t;
+            }
+        }
+        std::fprintf(stderr, "ink: INK_KERNELS=%s is not available here, using %s\n",
+                     forced, isaName(best->isa));
+    }
+    return *best;
+}
+
+} // namespace
+
+Table const &table()
+{
+    static Table const &chosen = choose();
+    return chosen;
+}
+
+char const *isaName(Isa isa)
+{
+    switch (isa) {
+    case Isa::BASELINE:
+        return "baseline";
+    case Isa::AVX2:
+        return "avx2";
+    case Isa::AVX512:
+        return "avx512";
+    }
+    return "unknown";
+}
+
+} // namespace Kernels
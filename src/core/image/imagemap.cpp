@@ -7,21 +7,21 @@
  * Copyright (C) 2018 Authors
  * Released under GNU GPL v2+, read the file 'COPYING' for more information.
  */
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <memory>
 #include "core/image/imagemap.h"
+#include "core/cpu/kernels.h"
 
+namespace {
 
-
-/*
- * GrayMap
+/**
+ * Write a binary PPM one row at a time; <fill> converts row y into the
+ * 3 * width byte buffer it is given.
  */
-
-GrayMap::GrayMap(int width, int height)
-    : MapBase(width, height)
-{
-}
-
-bool GrayMap::writePPM(char const *fileName)
+template <typename F>
+bool writeRows(char const *fileName, int width, int height, F &&fill)
 {
     if (!fileName) {
         return false;
@@ -34,19 +34,38 @@ bool GrayMap::writePPM(char const *fileName)
 
     std::fprintf(f, "P6 %d %d 255\n", width, height);
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            auto pix = getPixel(x, y) / 3;
-            unsigned char pixb = pix & 0xff;
-            std::fputc(pixb, f);
-            std::fputc(pixb, f);
-            std::fputc(pixb, f);
-        }
+    auto line = std::make_unique<unsigned char[]>(3 * (size_t)width);
+    bool ok = true;
+    for (int y = 0; y < height && ok; y++) {
+        fill(y, line.get());
+        ok = std::fwrite(line.get(), 3, width, f) == (size_t)width;
     }
 
-    std::fclose(f);
+    return std::fclose(f) == 0 && ok;
+}
+
+} // namespace
 
-    return true;
+
+
+/*
+ * GrayMap
+ */
+
+GrayMap::GrayMap(int width, int height)
+    : MapBase(width, height)
+{
+}
+
+bool GrayMap::writePPM(char const *fileName)
+{
+    return writeRows(fileName, width, height, [this] (int y, unsigned char *out) {
+        auto src = row(y);
+        for (int x = 0; x < width; x++) {
+            unsigned char pixb = (src[x] / 3) & 0xff;
+            out[3 * x] = out[3 * x + 1] = out[3 * x + 2] = pixb;
+        }
+    });
 }
 
 /*
@@ -60,29 +79,33 @@ RgbMap::RgbMap(int width, int height)
 
 bool RgbMap::writePPM(char const *fileName)
 {
-    if (!fileName) {
-        return false;
-    }
-
-    auto f = std::fopen(fileName, "wb");
-    if (!f) {
-        return false;
-    }
+    return writeRows(fileName, width, height, [this] (int y, unsigned char *out) {
+        std::memcpy(out, row(y), 3 * (size_t)width);
+    });
+}
 
-    std::fprintf(f, "P6 %d %d 255\n", width, height);
+/*
+ * GrayTiles
+ */
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            auto rgb = getPixel(x, y);
-            std::fputc(rgb.r, f);
-            std::fputc(rgb.g, f);
-            std::fputc(rgb.b, f);
-        }
-    }
+GrayTiles::GrayTiles(int width, int height)
+    : cols((width + TILE - 1) / TILE)
+    , rows((height + TILE - 1) / TILE)
+    , lo((size_t)cols * rows, GrayMap::WHITE)
+    , hi((size_t)cols * rows, GrayMap::BLACK)
+{
+}
 
-    std::fclose(f);
+/*
+ * PlanarRgbMap
+ */
 
-    return true;
+PlanarRgbMap::PlanarRgbMap(int width, int height)
+    : width(width)
+    , height(height)
+    , stride((width + ALIGN - 1) / ALIGN * ALIGN)
+    , samples((size_t)3 * stride * height)
+{
 }
 
 /*
@@ -98,46 +121,22 @@ IndexedMap::IndexedMap(int width, int height)
 
 bool IndexedMap::writePPM(char const *fileName)
 {
-    if (!fileName) {
-        return false;
-    }
-
-    auto f = std::fopen(fileName, "wb");
-    if (!f) {
-        return false;
-    }
-
-    std::fprintf(f, "P6 %d %d 255\n", width, height);
-
-    for (int y = 0; y < height; y++) {
+    return writeRows(fileName, width, height, [this] (int y, unsigned char *out) {
+        auto src = row(y);
+        auto dst = reinterpret_cast<RGB *>(out);
         for (int x = 0; x < width; x++) {
-            auto rgb = getPixelValue(x, y);
-            std::fputc(rgb.r, f);
-            std::fputc(rgb.g, f);
-            std::fputc(rgb.b, f);
+            dst[x] = clut[src[x]];
         }
-    }
-
-    std::fclose(f);
-
-    return true;
+    });
 }
 
 GrayMap rgbMapToGrayMap(RgbMap const &rgbmap) {
     auto graymap = GrayMap(rgbmap.width, rgbmap.height);
-    
-    for (int y = 0; y < rgbmap.height; y++) {
-        for (int x = 0; x < rgbmap.width; x++) {
-            auto rgb = rgbmap.getPixel(x, y);
-            int alpha = 255;
-            int white = 3 * (255 - alpha);
-            unsigned long sample = (int)rgb.r + (int)rgb.g + (int)rgb.b;
-            unsigned long bright = sample * alpha / 256 + white;
-            
-            graymap.setPixel(x, y, bright);
-        }
-    }
-    
+
+    // Translucent pixels are already composited over white, so every pixel
+    // counts as opaque here: no white to blend in, the sum is scaled by 255/256
+    Kernels::table().grayRow(rgbmap.pixels.data(), rgbmap.pixels.size(), graymap.pixels.data());
+
     return graymap;
 }
 
@@ -155,20 +154,127 @@ RgbMap grayMapToRgbMap(GrayMap const &graymap) {
     return rgbmap;
 }
 
+PixelBox rgbMapOpaqueBox(RgbMap const &rgbmap) {
+    if (!rgbmap.hasAlpha()) {
+        return {0, 0, rgbmap.width, rgbmap.height};
+    }
+
+    PixelBox box{rgbmap.width, rgbmap.height, 0, 0};
+    for (int y = 0; y < rgbmap.height; y++) {
+        auto a = rgbmap.alpha.data() + rgbmap.offset(0, y);
+        int x0 = 0;
+        while (x0 < rgbmap.width && !a[x0]) {
+            x0++;
+        }
+        if (x0 == rgbmap.width) {
+            continue;
+        }
+        int x1 = rgbmap.width;
+        while (!a[x1 - 1]) {
+            x1--;
+        }
+        box.x0 = std::min(box.x0, x0);
+        box.x1 = std::max(box.x1, x1);
+        box.y0 = std::min(box.y0, y);
+        box.y1 = y + 1;
+    }
+
+    return box;
+}
+
+RgbMap rgbMapCrop(RgbMap const &rgbmap, PixelBox const &box) {
+    int const width = std::max(box.x1 - box.x0, 0);
+    int const height = std::max(box.y1 - box.y0, 0);
+    auto out = RgbMap(width, height);
+
+    for (int y = 0; y < height; y++) {
+        auto src = rgbmap.row(box.y0 + y) + box.x0;
+        std::copy(src, src + width, out.row(y));
+    }
+    if (rgbmap.hasAlpha()) {
+        out.alpha.resize((size_t)width * height);
+        for (int y = 0; y < height; y++) {
+            auto src = rgbmap.alpha.data() + rgbmap.offset(box.x0, box.y0 + y);
+            std::copy(src, src + width, out.alpha.data() + out.offset(0, y));
+        }
+    }
+
+    return out;
+}
+
+PlanarRgbMap rgbMapToPlanar(RgbMap const &rgbmap) {
+    auto planar = PlanarRgbMap(rgbmap.width, rgbmap.height);
+
+    for (int y = 0; y < rgbmap.height; y++) {
+        auto src = rgbmap.row(y);
+        auto r = planar.row(0, y);
+        auto g = planar.row(1, y);
+        auto b = planar.row(2, y);
+        for (int x = 0; x < rgbmap.width; x++) {
+            r[x] = src[x].r;
+            g[x] = src[x].g;
+            b[x] = src[x].b;
+        }
+    }
+
+    return planar;
+}
+
+RgbMap planarToRgbMap(PlanarRgbMap const &planar) {
+    auto rgbmap = RgbMap(planar.width, planar.height);
+
+    for (int y = 0; y < planar.height; y++) {
+        auto r = planar.row(0, y);
+        auto g = planar.row(1, y);
+        auto b = planar.row(2, y);
+        auto dst = rgbmap.row(y);
+        for (int x = 0; x < planar.width; x++) {
+            dst[x] = {r[x], g[x], b[x]};
+        }
+    }
+
+    return rgbmap;
+}
+
 RgbMap indexedMapToRgbMap(IndexedMap const &indexedmap) {
     auto rgbmap = RgbMap(indexedmap.width, indexedmap.height);
-    
-    for (int y = 0; y < indexedmap.height; y++) {
-        for (int x = 0; x < indexedmap.width; x++) {
-            auto rgb = indexedmap.getPixelValue(x, y);
-            unsigned char r = rgb.r & 0xff;
-            unsigned char g = rgb.g & 0xff;
-            unsigned char b = rgb.b & 0xff;
-            rgbmap.setPixel(x, y, {r, g, b});
-        }
+
+    // A plain table lookup per pixel, no bounds to check
+    auto const &clut = indexedmap.clut;
+    auto src = indexedmap.pixels.data();
+    auto dst = rgbmap.pixels.data();
+    for (size_t i = 0, n = indexedmap.pixels.size(); i < n; i++) {
+        dst[i] = clut[src[i]];
     }
-    
+
     return rgbmap;
 }
 
+GrayTiles grayMapTiles(GrayMap const &graymap, int halo) {
+    auto tiles = GrayTiles(graymap.width, graymap.height);
+    int constexpr T = GrayTiles::TILE;
 
+    for (int y = 0; y < graymap.height; y++) {
+        // the tile rows whose grown range holds row y
+        int const r0 = std::max(y - halo, 0) / T;
+        int const r1 = std::min((y + halo) / T, tiles.rows - 1);
+        auto src = graymap.row(y);
+        for (int c = 0; c < tiles.cols; c++) {
+            int const x0 = std::max(c * T - halo, 0);
+            int const x1 = std::min((c + 1) * T + halo, graymap.width);
+            auto lo = src[x0];
+            auto hi = src[x0];
+            for (int x = x0 + 1; x < x1; x++) {
+                lo = std::min(lo, src[x]);
+                hi = std::max(hi, src[x]);
+            }
+            for (int r = r0; r <= r1; r++) {
+                int const i = tiles.index(c, r);
+                tiles.lo[i] = std::min(tiles.lo[i], lo);
+                tiles.hi[i] = std::max(tiles.hi[i], hi);
+            }
+        }
+    }
+
+    return tiles;
+}
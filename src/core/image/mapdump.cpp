@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Binary dumps of image maps, for checkpointing the stages of a trace.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#include "core/image/mapdump.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+char constexpr MAGIC[8] = {'I', 'N', 'K', 'D', 'U', 'M', 'P', 1};
+
+/// A view of the rows of <dump> if it holds a map of <kind> with samples
+/// of type T.
+template <typename T>
+std::optional<MapView<T>> viewRows(MappedDump &dump, DumpKind kind)
+{
+    auto const &header = dump.header();
+    if (header.kind != kind || header.rowBytes != (uint64_t)header.width * sizeof(T)) {
+        return {};
+    }
+    // rows start 64 byte aligned, so the samples can be used where they are
+    return MapView<T>{header.width, header.height, reinterpret_cast<T *>(dump.row(0))};
+}
+
+template <typename View, typename Map>
+void copyPixels(View const &view, Map &map)
+{
+    std::copy(view.pixels, view.pixels + map.pixels.size(), map.pixels.data());
+}
+
+} // namespace
+
+DumpHeader dumpHeader(DumpKind kind, int width, int height, uint64_t rowBytes, uint64_t extraBytes)
+{
+    DumpHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.byteOrder = DumpHeader::ORDER_MARK;
+    header.kind = kind;
+    header.width = width;
+    header.height = height;
+    header.rowBytes = rowBytes;
+    header.extraBytes = extraBytes;
+    return header;
+}
+
+bool writeDump(char const *fileName, DumpHeader const &header, void const *rows, void const *extra)
+{
+    if (!fileName) {
+        return false;
+    }
+
+    auto f = std::fopen(fileName, "wb");
+    if (!f) {
+        return false;
+    }
+
+    size_t const rowsSize = header.height * header.rowBytes;
+    bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+    if (ok && rowsSize) {
+        ok = std::fwrite(rows, 1, rowsSize, f) == rowsSize;
+    }
+    if (ok && header.extraBytes) {
+        ok = std::fwrite(extra, 1, header.extraBytes, f) == header.extraBytes;
+    }
+
+    return std::fclose(f) == 0 && ok;
+}
+
+bool writeDump(char const *fileName, GrayMap const &graymap)
+{
+    auto header = dumpHeader(DumpKind::GRAY, graymap.width, graymap.height,
+                             graymap.width * sizeof(unsigned long));
+    return writeDump(fileName, header, graymap.pixels.data());
+}
+
+bool writeDump(char const *fileName, RgbMap const &rgbmap)
+{
+    auto header = dumpHeader(DumpKind::RGB, rgbmap.width, rgbmap.height,
+                             rgbmap.width * sizeof(RGB), rgbmap.alpha.size());
+    return writeDump(fileName, header, rgbmap.pixels.data(), rgbmap.alpha.data());
+}
+
+bool writeDump(char const *fileName, IndexedMap const &indexedmap)
+{
+    // clut, then the color count
+    unsigned char extra[sizeof(indexedmap.clut) + sizeof(int32_t)];
+    int32_t const nrColors = indexedmap.nrColors;
+    std::memcpy(extra, indexedmap.clut.data(), sizeof(indexedmap.clut));
+    std::memcpy(extra + sizeof(indexedmap.clut), &nrColors, sizeof(nrColors));
+
+    auto header = dumpHeader(DumpKind::INDEXED, indexedmap.width, indexedmap.height,
+                             indexedmap.width, sizeof(extra));
+    return writeDump(fileName, header, indexedmap.pixels.data(), extra);
+}
+
+/*
+ * MappedDump
+ */
+
+std::optional<MappedDump> MappedDump::open(char const *fileName)
+{
+    if (!fileName) {
+        return {};
+    }
+
+    int fd = ::open(fileName, O_RDONLY);
+    if (fd < 0) {
+        return {};
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(DumpHeader)) {
+        ::close(fd);
+        return {};
+    }
+    size_t const size = st.st_size;
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        return {};
+    }
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    auto dump = MappedDump(static_cast<unsigned char *>(base), size);
+    auto const &header = dump.header();
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header.byteOrder != DumpHeader::ORDER_MARK ||
+        header.width < 0 || header.height < 0) {
+        return {};
+    }
+    // the parts must add up to the file, without overflowing on the way
+    uint64_t const body = size - sizeof(DumpHeader);
+    if (header.rowBytes && (uint64_t)header.height > body / header.rowBytes) {
+        return {};
+    }
+    if (header.height * header.rowBytes + header.extraBytes != body ||
+        header.extraBytes > body) {
+        return {};
+    }
+
+    return dump;
+}
+
+MappedDump::MappedDump(MappedDump &&other) noexcept
+    : base(std::exchange(other.base, nullptr))
+    , size(std::exchange(other.size, 0))
+{
+}
+
+MappedDump &MappedDump::operator=(MappedDump &&other) noexcept
+{
+    std::swap(base, other.base);
+    std::swap(size, other.size);
+    return *this;
+}
+
+MappedDump::~MappedDump()
+{
+    if (base) {
+        munmap(base, size);
+    }
+}
+
+/*
+ * Views
+ */
+
+std::optional<GrayMapView> grayMapView(MappedDump &dump)
+{
+    if (dump.header().extraBytes) {
+        return {};
+    }
+    return viewRows<unsigned long>(dump, DumpKind::GRAY);
+}
+
+std::optional<RgbMapView> rgbMapView(MappedDump &dump)
+{
+    auto rows = viewRows<RGB>(dump, DumpKind::RGB);
+    if (!rows) {
+        return {};
+    }
+    auto const &header = dump.header();
+    uint64_t const count = (uint64_t)header.width * header.height;
+    if (header.extraBytes != 0 && header.extraBytes != count) {
+        return {};
+    }
+    return RgbMapView{*rows, header.extraBytes ? dump.extra() : nullptr};
+}
+
+std::optional<IndexedMapView> indexedMapView(MappedDump &dump)
+{
+    auto rows = viewRows<unsigned char>(dump, DumpKind::INDEXED);
+    int32_t nrColors;
+    if (!rows || dump.header().extraBytes != sizeof(IndexedMap::clut) + sizeof(nrColors)) {
+        return {};
+    }
+    std::memcpy(&nrColors, dump.extra() + sizeof(IndexedMap::clut), sizeof(nrColors));
+    if (nrColors < 0 || nrColors > (int)(sizeof(IndexedMap::clut) / sizeof(RGB))) {
+        return {};
+    }
+    return IndexedMapView{*rows, reinterpret_cast<RGB const *>(dump.extra()), nrColors};
+}
+
+/*
+ * Loading
+ */
+
+std::optional<GrayMap> grayMapLoad(char const *fileName)
+{
+    auto dump = MappedDump::open(fileName);
+    auto view = dump ? grayMapView(*dump) : std::nullopt;
+    if (!view) {
+        return {};
+    }
+
+    auto graymap = GrayMap(view->width, view->height);
+    copyPixels(*view, graymap);
+    return graymap;
+}
+
+std::optional<RgbMap> rgbMapLoad(char const *fileName)
+{
+    auto dump = MappedDump::open(fileName);
+    auto view = dump ? rgbMapView(*dump) : std::nullopt;
+    if (!view) {
+        return {};
+    }
+
+    auto rgbmap = RgbMap(view->width, view->height);
+    copyPixels(*view, rgbmap);
+    if (view->alpha) {
+        rgbmap.alpha.assign(view->alpha, view->alpha + rgbmap.pixels.size());
+    }
+    return rgbmap;
+}
+
+std::optional<IndexedMap> indexedMapLoad(char const *fileName)
+{
+    auto dump = MappedDump::open(fileName);
+    auto view = dump ? indexedMapView(*dump) : std::nullopt;
+    if (!view) {
+        return {};
+    }
+
+    auto indexedmap = IndexedMap(view->width, view->height);
+    copyPixels(*view, indexedmap);
+    std::copy(view->clut, view->clut + indexedmap.clut.size(), indexedmap.clut.begin());
+    indexedmap.nrColors = view->nrColors;
+    return indexedmap;
+}
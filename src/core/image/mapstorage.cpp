@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Storage of map pixels: on the heap, or in mapped files for huge images.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#include "core/image/mapstorage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+std::mutex mutex;
+MapStorage storage;
+std::unordered_map<void *, size_t> mappings; ///< Mapped blocks and their sizes.
+std::atomic<size_t> nrMappings{0};            ///< Lets heap blocks skip the lock.
+std::atomic<size_t> mapFrom{(size_t)-1};      ///< Smallest size to map, all ones when off.
+
+/// A mapping of a fresh unlinked file in <directory>, or null.
+void *mapFile(std::string const &directory, size_t bytes)
+{
+    auto path = directory + "/ink-map-XXXXXX";
+    int fd = mkstemp(path.data());
+    if (fd < 0) {
+        return nullptr;
+    }
+    unlink(path.c_str());
+
+    // Reserve the blocks now: pages of a sparse file that cannot be
+    // backed once the disk fills up raise SIGBUS on first write.
+    void *memory = nullptr;
+    if (posix_fallocate(fd, 0, bytes) == 0) {
+        memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (memory == MAP_FAILED) {
+            memory = nullptr;
+        }
+    }
+    // the mapping keeps the file alive
+    close(fd);
+
+    if (memory) {
+        madvise(memory, bytes, MADV_SEQUENTIAL);
+    }
+    return memory;
+}
+
+} // namespace
+
+void setMapStorage(MapStorage const &s)
+{
+    std::lock_guard lock(mutex);
+    storage = s;
+    mapFrom = s.directory.empty() ? (size_t)-1 : std::max<size_t>(s.minBytes, 1);
+}
+
+MapStorage mapStorage()
+{
+    std::lock_guard lock(mutex);
+    return storage;
+}
+
+void *mapAllocate(size_t bytes)
+{
+    if (bytes >= mapFrom) {
+        if (void *memory = mapFile(mapStorage().directory, bytes)) {
+            std::lock_guard lock(mutex);
+            mappings.emplace(memory, bytes);
+            nrMappings++;
+            return memory;
+        }
+    }
+    return ::operator new(bytes);
+}
+
+void mapDeallocate(void *memory, size_t bytes)
+{
+    if (nrMappings > 0) {
+        std::lock_guard lock(mutex);
+        auto it = mappings.find(memory);
+        if (it != mappings.end()) {
+            munmap(memory, it->second);
+            mappings.erase(it);
+            nrMappings--;
+            return;
+        }
+    }
+    ::operator delete(memory, bytes);
+}
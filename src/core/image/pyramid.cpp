@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Mip pyramid of an RgbMap, for previews at reduced resolution.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#include "core/image/pyramid.h"
+#include "core/parallel/parallel.h"
+
+#include <algorithm>
+
+namespace {
+
+long halve(long size) { return (size + 1) / 2; }
+
+} // namespace
+
+RgbMap rgbMapHalve(RgbMap const &rgbmap, int nrThreads)
+{
+    int const w = halve(rgbmap.width);
+    int const h = halve(rgbmap.height);
+    auto out = RgbMap(w, h);
+
+    Parallel::forChunks(h, Parallel::chunkCount(h, nrThreads, 64), [&](int, int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            auto top = rgbmap.row(2 * y);
+            auto bottom = rgbmap.row(std::min(2 * y + 1, rgbmap.height - 1));
+            auto dst = out.row(y);
+            for (int x = 0; x < w; x++) {
+                int const x0 = 2 * x;
+                int const x1 = std::min(2 * x + 1, rgbmap.width - 1);
+                auto avg = [&](auto channel) {
+                    int sum = top[x0].*channel + top[x1].*channel + bottom[x0].*channel + bottom[x1].*channel;
+                    return static_cast<unsigned char>((sum + 2) / 4);
+                };
+                dst[x] = {avg(&RGB::r), avg(&RGB::g), avg(&RGB::b)};
+            }
+        }
+    });
+
+    if (rgbmap.hasAlpha()) {
+        out.alpha.resize((size_t)w * h);
+        for (int y = 0; y < h; y++) {
+            auto top = rgbmap.alpha.data() + rgbmap.offset(0, 2 * y);
+            auto bottom = rgbmap.alpha.data() + rgbmap.offset(0, std::min(2 * y + 1, rgbmap.height - 1));
+            auto dst = out.alpha.data() + out.offset(0, y);
+            for (int x = 0; x < w; x++) {
+                int const x0 = 2 * x;
+                int const x1 = std::min(2 * x + 1, rgbmap.width - 1);
+                // rounded up, so partly covered pixels do not vanish
+                dst[x] = (top[x0] + top[x1] + bottom[x0] + bottom[x1] + 3) / 4;
+            }
+        }
+    }
+
+    return out;
+}
+
+std::optional<RgbMap> rgbMapReduce(RgbMap const &rgbmap, long maxPixels, int nrThreads)
+{
+    if (maxPixels <= 0 || (long)rgbmap.width * rgbmap.height <= maxPixels) {
+        return {};
+    }
+    auto reduced = rgbMapHalve(rgbmap, nrThreads);
+    while ((long)reduced.width * reduced.height > maxPixels) {
+        reduced = rgbMapHalve(reduced, nrThreads);
+    }
+    return reduced;
+}
+
+RgbPyramid::RgbPyramid(RgbMap base, int nrThreads)
+    : baseWidth(base.width)
+    , baseHeight(base.height)
+    , nrThreads(nrThreads)
+{
+    nrLevels = 1;
+    for (int w = base.width, h = base.height; w > 1 || h > 1; w = halve(w), h = halve(h)) {
+        nrLevels++;
+    }
+    levels.push_back(std::move(base));
+}
+
+RgbMap const &RgbPyramid::level(int index)
+{
+    index = std::clamp(index, 0, nrLevels - 1);
+    std::lock_guard lock(mutex);
+    while ((int)levels.size() <= index) {
+        levels.push_back(rgbMapHalve(levels.back(), nrThreads));
+    }
+    return levels[index];
+}
+
+long RgbPyramid::levelPixels(int index) const
+{
+    long w = baseWidth;
+    long h = baseHeight;
+    for (int i = 0; i < index; i++) {
+        w = halve(w);
+        h = halve(h);
+    }
+    return w * h;
+}
+
+int RgbPyramid::levelFor(long minPixels) const
+{
+    int index = 0;
+    while (index + 1 < nrLevels && levelPixels(index + 1) >= minPixels) {
+        index++;
+    }
+    return index;
+}
@@ -0,0 +1,533 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Centerline tracing: open stroked paths along the skeleton of line art.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#include "engines/centerline/centerline.h"
+#include "core/parallel/parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <locale>
+#include <map>
+#include <sstream>
+#include <vector>
+
+namespace Centerline {
+
+namespace {
+
+/**
+ * A bilevel image with a one pixel background border, so that every image
+ * pixel has all eight neighbours.
+ */
+struct Plane {
+  int width;
+  int height;
+  int stride;
+  std::vector<uint8_t> pixels;
+
+  Plane(int width, int height)
+      : width(width), height(height), stride(width + 2),
+        pixels((width + 2) * (height + 2)) {}
+
+  int index(int x, int y) const { return (y + 1) * stride + x + 1; }
+  uint8_t *row(int y) { return pixels.data() + index(0, y); }
+  uint8_t const *row(int y) const { return pixels.data() + index(0, y); }
+};
+
+/**
+ * Neighbours of p as a byte, clockwise from north: bit 0 N, 1 NE, 2 E,
+ * 3 SE, 4 S, 5 SW, 6 W, 7 NW.
+ */
+inline int neighbours(uint8_t const *p, int stride) {
+  return p[-stride] | p[-stride + 1] << 1 | p[1] << 2 | p[stride + 1] << 3 |
+         p[stride] << 4 | p[stride - 1] << 5 | p[-1] << 6 |
+         p[-stride - 1] << 7;
+}
+
+// 邻域偏移, 与 neighbours() 的位序一致
+std::array<int, 8> neighbourOffsets(int stride) {
+  return {-stride, -stride + 1, 1, stride + 1, stride, stride - 1, -1,
+          -stride - 1};
+}
+
+// Zhang-Suen 细化: 两个子迭代各一张删除表
+std::array<std::array<bool, 256>, 2> const THINNING = [] {
+  std::array<std::array<bool, 256>, 2> table{};
+  for (int code = 0; code < 256; code++) {
+    auto bit = [&](int i) { return (code >> (i & 7)) & 1; };
+    int b = std::popcount((unsigned)code);
+    int a = 0;
+    for (int i = 0; i < 8; i++) {
+      a += !bit(i) && bit(i + 1);
+    }
+    bool base = b >= 2 && b <= 6 && a == 1;
+    int n = bit(0), e = bit(2), s = bit(4), w = bit(6);
+    table[0][code] = base && !(n && e && s) && !(e && s && w);
+    table[1][code] = base && !(n && e && w) && !(n && s && w);
+  }
+  return table;
+}();
+
+// 邻域中前景的 8 连通分量数
+std::array<uint8_t, 256> const COMPONENTS = [] {
+  std::array<uint8_t, 256> table{};
+  for (int code = 0; code < 256; code++) {
+    std::array<int, 8> parent;
+    for (int i = 0; i < 8; i++) {
+      parent[i] = i;
+    }
+    auto find = [&](int i) {
+      while (parent[i] != i) {
+        i = parent[i];
+      }
+      return i;
+    };
+    auto set = [&](int i) { return (code >> (i & 7)) & 1; };
+    for (int i = 0; i < 8; i++) {
+      // ring neighbours touch, and so do the edge pixels around a corner
+      int reach = i % 2 == 0 ? 2 : 1;
+      for (int d = 1; d <= reach; d++) {
+        if (set(i) && set(i + d)) {
+          parent[find(i)] = find((i + d) & 7);
+        }
+      }
+    }
+    for (int i = 0; i < 8; i++) {
+      table[code] += set(i) && find(i) == i;
+    }
+  }
+  return table;
+}();
+
+// 阈值化
+Plane threshold(RgbMap const &rgbmap, double brightnessThreshold, bool invert,
+                int nrThreads) {
+  Plane plane(rgbmap.width, rgbmap.height);
+  int const cutoff = 3.0 * brightnessThreshold * 256.0;
+
+  Parallel::forChunks(
+      rgbmap.height, Parallel::chunkCount(rgbmap.height, nrThreads, 64),
+      [&](int, int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+          auto src = rgbmap.row(y);
+          auto dst = plane.row(y);
+          for (int x = 0; x < rgbmap.width; x++) {
+            bool black = src[x].r + src[x].g + src[x].b < cutoff;
+            // 完全透明的像素不算线条
+            dst[x] = black != invert && !rgbmap.isTransparent(x, y);
+          }
+        }
+      });
+
+  return plane;
+}
+
+/**
+ * Zhang-Suen thinning. Each subiteration decides every deletion from the
+ * same state, so rows are split over threads freely.
+ */
+void thin(Plane &plane, int nrThreads) {
+  std::vector<uint8_t> marks(plane.pixels.size());
+  int const nrChunks = Parallel::chunkCount(plane.height, nrThreads, 32);
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int step = 0; step < 2; step++) {
+      auto const &table = THINNING[step];
+      std::atomic<bool> any{false};
+
+      Parallel::forChunks(plane.height, nrChunks, [&](int, int y0, int y1) {
+        bool found = false;
+        for (int y = y0; y < y1; y++) {
+          auto p = plane.row(y);
+          auto m = marks.data() + plane.index(0, y);
+          for (int x = 0; x < plane.width; x++) {
+            m[x] = p[x] && table[neighbours(p + x, plane.stride)];
+            found |= m[x];
+          }
+        }
+        if (found) {
+          any = true;
+        }
+      });
+
+      if (!any) {
+        continue;
+      }
+      changed = true;
+
+      Parallel::forChunks(plane.height, nrChunks, [&](int, int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+          auto p = plane.row(y);
+          auto m = marks.data() + plane.index(0, y);
+          for (int x = 0; x < plane.width; x++) {
+            p[x] &= !m[x];
+          }
+        }
+      });
+    }
+  }
+}
+
+/**
+ * Remove the redundant corner pixels thinning leaves on staircases, so
+ * that every pixel in the middle of a stroke has exactly two neighbours.
+ * A pixel goes when its neighbours stay connected without it and it
+ * touches the background on a side. Sequential, as each removal changes
+ * the next decision.
+ */
+void pruneCorners(Plane &plane) {
+  for (int y = 0; y < plane.height; y++) {
+    auto p = plane.row(y);
+    for (int x = 0; x < plane.width; x++) {
+      if (!p[x]) {
+        continue;
+      }
+      int code = neighbours(p + x, plane.stride);
+      bool open = (code & 0x55) != 0x55;
+      if (open && std::popcount((unsigned)code) >= 2 && COMPONENTS[code] == 1) {
+        p[x] = 0;
+      }
+    }
+  }
+}
+
+/**
+ * Chamfer (3, 4) distance of every foreground pixel to the background, in
+ * thirds of a pixel.
+ */
+std::vector<uint16_t> distances(Plane const &shape) {
+  std::vector<uint16_t> d(shape.pixels.size());
+  int const s = shape.stride;
+  for (size_t i = 0; i < d.size(); i++) {
+    d[i] = shape.pixels[i] ? UINT16_MAX : 0;
+  }
+  auto relax = [&](int i, int j, int step) {
+    if (d[j] + step < d[i]) {
+      d[i] = d[j] + step;
+    }
+  };
+  for (int y = 0; y < shape.height; y++) {
+    for (int x = 0, i = shape.index(0, y); x < shape.width; x++, i++) {
+      if (d[i]) {
+        relax(i, i - s, 3);
+        relax(i, i - 1, 3);
+        relax(i, i - s - 1, 4);
+        relax(i, i - s + 1, 4);
+      }
+    }
+  }
+  for (int y = shape.height - 1; y >= 0; y--) {
+    for (int x = shape.width - 1, i = shape.index(x, y); x >= 0; x--, i--) {
+      if (d[i]) {
+        relax(i, i + s, 3);
+        relax(i, i + 1, 3);
+        relax(i, i + s + 1, 4);
+        relax(i, i + s - 1, 4);
+      }
+    }
+  }
+  return d;
+}
+
+// 骨架上的一笔
+struct Stroke {
+  std::vector<int> pixels; // 平面索引
+  bool closed = false;
+  bool spur = false; // 一端悬空, 一端在分叉点
+};
+
+/**
+ * Split the skeleton into strokes: runs of two-neighbour pixels between
+ * ends and junctions, plus the closed loops that have neither. Junction
+ * pixels next to each other form one junction, with no strokes inside it.
+ */
+std::vector<Stroke> strokes(Plane const &skeleton) {
+  auto const offsets = neighbourOffsets(skeleton.stride);
+  auto const &px = skeleton.pixels;
+  auto degree = [&](int i) {
+    return std::popcount((unsigned)neighbours(px.data() + i, skeleton.stride));
+  };
+  std::vector<uint8_t> visited(px.size());
+  std::vector<Stroke> result;
+
+  // 沿度为 2 的像素走到下一个节点
+  auto walk = [&](Stroke &stroke, int prev, int cur) {
+    for (;;) {
+      stroke.pixels.push_back(cur);
+      if (degree(cur) != 2 || visited[cur]) {
+        return;
+      }
+      visited[cur] = 1;
+      int next = -1;
+      for (int off : offsets) {
+        if (px[cur + off] && cur + off != prev) {
+          next = cur + off;
+          break;
+        }
+      }
+      prev = cur;
+      cur = next;
+    }
+  };
+
+  for (int y = 0; y < skeleton.height; y++) {
+    for (int x = 0, i = skeleton.index(0, y); x < skeleton.width; x++, i++) {
+      if (!px[i]) {
+        continue;
+      }
+      int const deg = degree(i);
+      if (deg == 2) {
+        continue;
+      }
+      if (deg == 0) {
+        result.push_back({{i}});
+        continue;
+      }
+      for (int off : offsets) {
+        int const j = i + off;
+        if (!px[j] || visited[j]) {
+          continue;
+        }
+        // 相邻节点: 各记一次; 同一分叉团内部不成笔
+        int const nextDeg = degree(j);
+        if (nextDeg != 2 && (j < i || (deg > 2 && nextDeg > 2))) {
+          continue;
+        }
+        Stroke stroke;
+        stroke.pixels.push_back(i);
+        walk(stroke, i, j);
+        int const endDeg = degree(stroke.pixels.back());
+        stroke.spur = (deg == 1) != (endDeg == 1);
+        result.push_back(std::move(stroke));
+      }
+    }
+  }
+
+  // 剩下的都是闭环
+  for (int y = 0; y < skeleton.height; y++) {
+    for (int x = 0, i = skeleton.index(0, y); x < skeleton.width; x++, i++) {
+      if (!px[i] || visited[i] || degree(i) != 2) {
+        continue;
+      }
+      Stroke stroke;
+      stroke.closed = true;
+      int next = -1;
+      for (int off : offsets) {
+        if (px[i + off]) {
+          next = i + off;
+          break;
+        }
+      }
+      visited[i] = 1;
+      stroke.pixels.push_back(i);
+      walk(stroke, i, next);
+      result.push_back(std::move(stroke));
+    }
+  }
+
+  return result;
+}
+
+struct Point {
+  double x;
+  double y;
+};
+
+// Ramer-Douglas-Peucker 简化
+void simplify(std::vector<Point> const &pts, int first, int last,
+              double tolerance, std::vector<Point> &out) {
+  double const dx = pts[last].x - pts[first].x;
+  double const dy = pts[last].y - pts[first].y;
+  double const len = std::hypot(dx, dy);
+  int worst = -1;
+  double worstDist = tolerance;
+  for (int i = first + 1; i < last; i++) {
+    double dist = len > 0
+                      ? std::abs(dy * (pts[i].x - pts[first].x) -
+                                 dx * (pts[i].y - pts[first].y)) / len
+                      : std::hypot(pts[i].x - pts[first].x, pts[i].y - pts[first].y);
+    if (dist > worstDist) {
+      worst = i;
+      worstDist = dist;
+    }
+  }
+  if (worst < 0) {
+    out.push_back(pts[last]);
+    return;
+  }
+  simplify(pts, first, worst, tolerance, out);
+  simplify(pts, worst, last, tolerance, out);
+}
+
+/**
+ * Fit a stroke with cubic Beziers through its simplified vertices. Tangents
+ * follow the neighbouring vertices (Catmull-Rom), except at sharp turns,
+ * which are kept as corners.
+ */
+std::string fitStroke(Stroke const &stroke, Plane const &plane,
+                      double tolerance) {
+  std::vector<Point> pts;
+  pts.reserve(stroke.pixels.size() + 1);
+  for (int i : stroke.pixels) {
+    pts.push_back({i % plane.stride - 1 + 0.5, i / plane.stride - 1 + 0.5});
+  }
+
+  std::ostringstream out;
+  out.imbue(std::locale::classic());
+  out << std::fixed << std::setprecision(2);
+
+  // 孤立点: 零长度线段, 由圆形线帽画出
+  if (pts.size() == 1) {
+    out << "M" << pts[0].x << "," << pts[0].y << "h0";
+    return out.str();
+  }
+
+  // 闭环的首尾是同一像素
+  std::vector<Point> v{pts.front()};
+  simplify(pts, 0, pts.size() - 1, tolerance, v);
+
+  int const n = v.size();
+  auto vertex = [&](int i) {
+    if (stroke.closed) {
+      return v[((i % (n - 1)) + (n - 1)) % (n - 1)];
+    }
+    return v[std::clamp(i, 0, n - 1)];
+  };
+  auto sharp = [&](int i) {
+    if (!stroke.closed && (i <= 0 || i >= n - 1)) {
+      return false;
+    }
+    auto a = vertex(i - 1), b = vertex(i), c = vertex(i + 1);
+    double ux = b.x - a.x, uy = b.y - a.y, wx = c.x - b.x, wy = c.y - b.y;
+    double cosTurn = (ux * wx + uy * wy) /
+                     (std::hypot(ux, uy) * std::hypot(wx, wy) + 1e-12);
+    return cosTurn < 0.5; // 转角超过 60 度
+  };
+  auto tangent = [&](int i) {
+    if (sharp(i)) {
+      return Point{0, 0};
+    }
+    auto a = vertex(i - 1), c = vertex(i + 1);
+    return Point{(c.x - a.x) / 6, (c.y - a.y) / 6};
+  };
+
+  out << "M" << v[0].x << "," << v[0].y;
+  if (n == 2) {
+    out << "L" << v[1].x << "," << v[1].y;
+    return out.str();
+  }
+  for (int i = 0; i + 1 < n; i++) {
+    auto t0 = tangent(i), t1 = tangent(i + 1);
+    out << "C" << v[i].x + t0.x << "," << v[i].y + t0.y << " "
+        << v[i + 1].x - t1.x << "," << v[i + 1].y - t1.y << " "
+        << v[i + 1].x << "," << v[i + 1].y;
+  }
+  if (stroke.closed) {
+    out << "Z";
+  }
+  return out.str();
+}
+
+} // namespace
+
+CenterlineTracingEngine::CenterlineTracingEngine(double brightnessThreshold,
+                                                 bool invert)
+    : brightnessThreshold(brightnessThreshold), invert(invert) {}
+
+// 设置简化容差
+void CenterlineTracingEngine::setTolerance(double tolerance) {
+  this->tolerance = tolerance;
+}
+
+// 设置毛刺长度
+void CenterlineTracingEngine::setSpurLength(int spurLength) {
+  this->spurLength = spurLength;
+}
+
+// 设置线程数
+void CenterlineTracingEngine::setThreads(int nrThreads) {
+  this->nrThreads = nrThreads;
+}
+
+// 追踪
+TraceResult CenterlineTracingEngine::trace(RgbMap const &rgbmap) const {
+  auto shape = threshold(rgbmap, brightnessThreshold, invert, nrThreads);
+  auto skeleton = shape;
+  thin(skeleton, nrThreads);
+  pruneCorners(skeleton);
+  auto const dist = distances(shape);
+
+  auto all = strokes(skeleton);
+  std::vector<Stroke> kept;
+  for (auto &stroke : all) {
+    if (!stroke.spur || (int)stroke.pixels.size() > spurLength) {
+      kept.push_back(std::move(stroke));
+    }
+  }
+
+  // 拟合每一笔, 并由距离场估计线宽
+  std::vector<std::string> paths(kept.size());
+  std::vector<double> widths(kept.size());
+  Parallel::forChunks(
+      kept.size(), Parallel::chunkCount(kept.size(), nrThreads, 256),
+      [&](int, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+          double sum = 0;
+          for (int p : kept[i].pixels) {
+            sum += dist[p];
+          }
+          double radius = sum / kept[i].pixels.size() / 3.0;
+          double width = std::max(1.0, 2.0 * radius - 1.0);
+          widths[i] = std::round(width * 2.0) / 2.0;
+          paths[i] = fitStroke(kept[i], skeleton, tolerance);
+        }
+      });
+
+  // 同宽的笔画合为一项
+  std::map<double, std::string> byWidth;
+  for (size_t i = 0; i < kept.size(); i++) {
+    byWidth[widths[i]] += paths[i];
+  }
+
+  TraceResult results;
+  for (auto &[width, pathData] : byWidth) {
+    std::ostringstream style;
+    style.imbue(std::locale::classic());
+    style << "fill:none;stroke:#000000;stroke-width:" << width
+          << ";stroke-linecap:round;stroke-linejoin:round";
+    results.items.emplace_back(style.str(), std::move(pathData));
+  }
+  return results;
+}
+
+// 预览: 浅灰为阈值化的形状, 黑色为骨架
+RgbMap CenterlineTracingEngine::preview(RgbMap const &rgbmap) const {
+  auto shape = threshold(rgbmap, brightnessThreshold, invert, nrThreads);
+  auto skeleton = shape;
+  thin(skeleton, nrThreads);
+  pruneCorners(skeleton);
+
+  auto out = RgbMap(rgbmap.width, rgbmap.height);
+  for (int y = 0; y < rgbmap.height; y++) {
+    auto s = shape.row(y);
+    auto k = skeleton.row(y);
+    for (int x = 0; x < rgbmap.width; x++) {
+      unsigned char v = k[x] ? 0 : s[x] ? 192 : 255;
+      out.setPixel(x, y, {v, v, v});
+    }
+  }
+  return out;
+}
+
+} // namespace Centerline
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Binary dumps of packed potrace bitmaps
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#include "engines/potrace/bitmapdump.h"
+#include "engines/potrace/pbitmap.h"
+
+namespace Potrace {
+
+bool bitmapWriteDump(char const *fileName, potrace_bitmap_t const *bm) {
+  auto header = dumpHeader(DumpKind::BITMAP, bm->w, bm->h,
+                           (uint64_t)bm->dy * BM_WORDSIZE);
+  return writeDump(fileName, header, bm->map);
+}
+
+std::optional<potrace_bitmap_t> bitmapView(MappedDump &dump) {
+  auto const &header = dump.header();
+  int const dy = header.width == 0 ? 0 : (header.width - 1) / BM_WORDBITS + 1;
+  if (header.kind != DumpKind::BITMAP ||
+      header.rowBytes != (uint64_t)dy * BM_WORDSIZE) {
+    return {};
+  }
+
+  // rows start 64 byte aligned, so the words can be used where they are
+  potrace_bitmap_t bm;
+  bm.w = header.width;
+  bm.h = header.height;
+  bm.dy = dy;
+  bm.map = reinterpret_cast<potrace_word *>(dump.row(0));
+  return bm;
+}
+
+} // namespace Potrace
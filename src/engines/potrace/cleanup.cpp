@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Speckle removal and morphology on packed potrace bitmaps
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#include "engines/potrace/cleanup.h"
+#include "engines/potrace/components.h"
+#include "engines/potrace/pbitmap.h"
+
+namespace Potrace {
+
+void bitmapRemoveSpecks(potrace_bitmap_t *bm, long minArea, int nrThreads) {
+  for (auto const &c : bitmapComponents(bm, nrThreads, 1)) {
+    if (c.area >= minArea) {
+      continue;
+    }
+    for (auto const &run : c.runs) {
+      bm_clearrange(bm, run.y, run.x0, run.x1);
+    }
+  }
+}
+
+bool bitmapCleanup(potrace_bitmap_t *bm, BitmapCleanup const &cleanup,
+                   int nrThreads) {
+  if (cleanup.minArea > 0) {
+    // specks, then holes as the specks of the inverted bitmap
+    bitmapRemoveSpecks(bm, cleanup.minArea, nrThreads);
+    bm_invert(bm);
+    bitmapRemoveSpecks(bm, cleanup.minArea, nrThreads);
+    bm_invert(bm);
+  }
+  if (cleanup.open > 0 && bm_open(bm, cleanup.open)) {
+    return false;
+  }
+  if (cleanup.close > 0 && bm_close(bm, cleanup.close)) {
+    return false;
+  }
+  return true;
+}
+
+} // namespace Potrace
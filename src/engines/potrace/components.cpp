@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Connected component labeling on packed potrace bitmaps
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#include "engines/potrace/components.h"
+#include "engines/potrace/pbitmap.h"
+#include "core/parallel/parallel.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace {
+
+using Potrace::PixelRun;
+
+/**
+ * append the runs of row <y> to <runs>, scanning whole words at a time
+ */
+void rowRuns(potrace_bitmap_t const *bm, int y, std::vector<PixelRun> &runs) {
+  potrace_word const *line = bm_scanline(bm, y);
+  bool inside = false;
+  int start = 0;
+  for (int k = 0; k < bm->dy; k++) {
+    potrace_word const word = line[k];
+    int const base = k * BM_WORDBITS;
+    int pos = 0;
+    while (pos < BM_WORDBITS) {
+      // look for the next 1 bit outside a run, the next 0 bit inside
+      potrace_word rest = (inside ? ~word : word) << pos;
+      if (!rest) {
+        break;
+      }
+      pos += std::countl_zero(rest);
+      if (base + pos >= bm->w) {
+        break;
+      }
+      if (inside) {
+        runs.push_back({y, start, base + pos});
+      } else {
+        start = base + pos;
+      }
+      inside = !inside;
+    }
+  }
+  if (inside) {
+    runs.push_back({y, start, bm->w});
+  }
+}
+
+int findRoot(std::vector<int> &parent, int i) {
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+/**
+ * join two sets, the lowest index becomes the root
+ */
+void unite(std::vector<int> &parent, int a, int b) {
+  a = findRoot(parent, a);
+  b = findRoot(parent, b);
+  if (a < b) {
+    parent[b] = a;
+  } else if (b < a) {
+    parent[a] = b;
+  }
+}
+
+/**
+ * unite the runs of row <y> with the runs of row <y> - <dr> that are at
+ * most <reach> pixels away
+ */
+void uniteRows(std::vector<PixelRun> const &runs, std::vector<int> const &rowStart,
+               std::vector<int> &parent, int y, int dr, int reach) {
+  int a = rowStart[y - dr], aEnd = rowStart[y - dr + 1];
+  int b = rowStart[y], bEnd = rowStart[y + 1];
+  if (dr == 0) {
+    // neighbours in the same row
+    for (int i = b + 1; i < bEnd; i++) {
+      if (runs[i].x0 < runs[i - 1].x1 + reach) {
+        unite(parent, i - 1, i);
+      }
+    }
+    return;
+  }
+  while (a < aEnd && b < bEnd) {
+    auto const &ra = runs[a];
+    auto const &rb = runs[b];
+    if (rb.x0 < ra.x1 + reach && ra.x0 < rb.x1 + reach) {
+      unite(parent, a, b);
+    }
+    // advance the run that ends first
+    if (ra.x1 < rb.x1) {
+      a++;
+    } else {
+      b++;
+    }
+  }
+}
+
+} // namespace
+
+namespace Potrace {
+
+std::vector<BitmapComponent> bitmapComponents(potrace_bitmap_t const *bm,
+                                              int nrThreads, int reach) {
+  int const height = bm->h;
+  int const nchunks = Parallel::chunkCount(height, nrThreads, 4 * reach + 64);
+
+  // extract the runs of every row, chunks of rows in parallel
+  std::vector<std::vector<PixelRun>> chunkRuns(nchunks);
+  std::vector<int> chunkBegin(nchunks + 1, height);
+  Parallel::forChunks(height, nchunks, [&](int chunk, int begin, int end) {
+    chunkBegin[chunk] = begin;
+    for (int y = begin; y < end; y++) {
+      rowRuns(bm, y, chunkRuns[chunk]);
+    }
+  });
+
+  std::vector<PixelRun> runs;
+  std::vector<int> rowStart(height + 1, 0);
+  for (auto const &cr : chunkRuns) {
+    runs.insert(runs.end(), cr.begin(), cr.end());
+  }
+  chunkRuns.clear();
+  for (auto const &run : runs) {
+    rowStart[run.y + 1]++;
+  }
+  for (int y = 0; y < height; y++) {
+    rowStart[y + 1] += rowStart[y];
+  }
+
+  // unite near runs, rows of each chunk in parallel and then the few rows
+  // that reach across chunk boundaries
+  std::vector<int> parent(runs.size());
+  for (size_t i = 0; i < parent.size(); i++) {
+    parent[i] = i;
+  }
+  Parallel::forChunks(height, nchunks, [&](int, int begin, int end) {
+    for (int y = begin; y < end; y++) {
+      for (int dr = 0; dr <= reach && y - dr >= begin; dr++) {
+        uniteRows(runs, rowStart, parent, y, dr, reach);
+      }
+    }
+  });
+  for (int chunk = 1; chunk < nchunks; chunk++) {
+    int const begin = chunkBegin[chunk];
+    for (int y = begin; y < std::min(begin + reach, height); y++) {
+      for (int dr = y - begin + 1; dr <= reach && y - dr >= 0; dr++) {
+        uniteRows(runs, rowStart, parent, y, dr, reach);
+      }
+    }
+  }
+
+  // roots are the first run of their set, so numbering them in run order
+  // gives components in raster order
+  std::vector<BitmapComponent> components;
+  std::vector<int> label(runs.size());
+  for (size_t i = 0; i < runs.size(); i++) {
+    int root = findRoot(parent, i);
+    if (root == (int)i) {
+      label[i] = components.size();
+      components.push_back({runs[i].x0, runs[i].y, runs[i].x1, runs[i].y + 1, 0, {}});
+    } else {
+      label[i] = label[root];
+    }
+    auto &c = components[label[i]];
+    auto const &run = runs[i];
+    c.x0 = std::min(c.x0, run.x0);
+    c.x1 = std::max(c.x1, run.x1);
+    c.y1 = run.y + 1;
+    c.area += run.x1 - run.x0;
+    c.runs.push_back(run);
+  }
+
+  return components;
+}
+
+bool bitmapHasRun(potrace_bitmap_t const *bm, int length) {
+  std::vector<PixelRun> runs;
+  for (int y = 0; y < bm->h; y++) {
+    runs.clear();
+    rowRuns(bm, y, runs);
+    for (auto const &run : runs) {
+      if (run.x1 - run.x0 > length) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+} // namespace Potrace
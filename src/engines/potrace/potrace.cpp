@@ -1,10 +1,15 @@
 #include "engines/potrace/potrace.h"
+#include "engines/potrace/components.h"
+#include "core/parallel/parallel.h"
 #include "filters/filterset.h"
 #include "trace/trace.h"
+#include <algorithm>
+#include <array>
 #include <locale>
 #include <sstream>
 #include <iomanip>
 #include <unordered_set>
+#include <utility>
 
 namespace {
 
@@ -15,12 +20,208 @@ struct potrace_state_deleter {
 using potrace_state_uniqptr =
     std::unique_ptr<potrace_state_t, potrace_state_deleter>;
 
-// 位图删除器
-struct potrace_bitmap_deleter {
-  void operator()(potrace_bitmap_t *p) { bm_free(p); };
+using Potrace::potrace_bitmap_uniqptr;
+
+/**
+ * Packs rows of palette indices straight into one potrace bitmap per color.
+ * In stacked mode the bitmap of color i also holds every color below i.
+ * Fully transparent pixels of <image> go into no layer.
+ */
+class LayerSink final : public IndexRowSink {
+public:
+  LayerSink(bool stack, RgbMap const &image) : stack(stack), image(image) {}
+
+  void begin(int width, int height, int nrColors) override {
+    for (int i = 0; i < nrColors; i++) {
+      auto bm = potrace_bitmap_uniqptr(bm_new(width, height));
+      if (!bm) {
+        layers.clear();
+        return;
+      }
+      bm_clear(bm.get(), 0);
+      layers.push_back(std::move(bm));
+    }
+  }
+
+  void row(int y, unsigned const *indices) override {
+    if (layers.empty()) {
+      return;
+    }
+    int const width = layers[0]->w;
+    if (image.hasAlpha()) {
+      auto alpha = image.alpha.data() + image.offset(0, y);
+      for (int x = 0; x < width; x++) {
+        if (alpha[x]) {
+          auto &bm = layers[indices[x]];
+          BM_USET(bm, x, y);
+        }
+      }
+    } else {
+      for (int x = 0; x < width; x++) {
+        auto &bm = layers[indices[x]];
+        BM_USET(bm, x, y);
+      }
+    }
+    if (stack) {
+      int const dy = layers[0]->dy;
+      for (size_t i = 1; i < layers.size(); i++) {
+        auto const *below = bm_scanline(layers[i - 1], y);
+        auto *line = bm_scanline(layers[i], y);
+        for (int k = 0; k < dy; k++) {
+          line[k] |= below[k];
+        }
+      }
+    }
+  }
+
+  std::vector<potrace_bitmap_uniqptr> layers;
+
+private:
+  bool stack;
+  RgbMap const &image;
 };
-using potrace_bitmap_uniqptr =
-    std::unique_ptr<potrace_bitmap_t, potrace_bitmap_deleter>;
+
+/**
+ * Margin kept around the opaque part of an image when cropping to it, so
+ * that neighbourhood filters (smoothing, edge detection) see the same
+ * surroundings as on the whole image.
+ */
+int constexpr CROP_MARGIN = 4;
+
+// 清除位图中完全透明的像素
+void clearTransparent(potrace_bitmap_t *bm, RgbMap const &image) {
+  if (!image.hasAlpha()) {
+    return;
+  }
+  for (int y = 0; y < bm->h; y++) {
+    auto alpha = image.alpha.data() + image.offset(0, y);
+    for (int x = 0; x < bm->w; x++) {
+      if (!alpha[x]) {
+        BM_UCLR(bm, x, y);
+      }
+    }
+  }
+}
+
+/**
+ * Bounds of the set pixels of a bitmap, with x0 rounded down to a word so
+ * that rows can be copied a word at a time. Empty when nothing is set.
+ */
+PixelBox occupiedBox(potrace_bitmap_t const *bm) {
+  PixelBox box{bm->w, bm->h, 0, 0};
+  for (int y = 0; y < bm->h; y++) {
+    auto line = bm_scanline(bm, y);
+    int k0 = 0;
+    while (k0 < bm->dy && !line[k0]) {
+      k0++;
+    }
+    if (k0 == bm->dy) {
+      continue;
+    }
+    int k1 = bm->dy;
+    while (!line[k1 - 1]) {
+      k1--;
+    }
+    box.x0 = std::min(box.x0, k0 * BM_WORDBITS);
+    box.x1 = std::max(box.x1, std::min(k1 * BM_WORDBITS, bm->w));
+    box.y0 = std::min(box.y0, y);
+    box.y1 = y + 1;
+  }
+  return box;
+}
+
+// 复制位图的一块 (box.x0 须在字边界上)
+potrace_bitmap_uniqptr cropBitmap(potrace_bitmap_t const *bm,
+                                  PixelBox const &box) {
+  auto crop =
+      potrace_bitmap_uniqptr(bm_new(box.x1 - box.x0, box.y1 - box.y0));
+  if (!crop) {
+    return nullptr;
+  }
+  int const k0 = box.x0 / BM_WORDBITS;
+  for (int y = 0; y < crop->h; y++) {
+    auto src = bm_scanline(bm, box.y0 + y) + k0;
+    std::copy(src, src + crop->dy, bm_scanline(crop.get(), y));
+  }
+  return crop;
+}
+
+// 调色板转灰度
+void clutToMono(std::array<RGB, 256> &clut) {
+  for (auto &c : clut) {
+    unsigned char s = ((int)c.r + (int)c.g + (int)c.b) / 3;
+    c = {s, s, s};
+  }
+}
+
+/**
+ * The layer multiScanRemoveBackground would drop, or -1 when that cannot be
+ * known without tracing. It is the last layer with pixels, as long as both
+ * it and some layer below it are sure to give paths.
+ */
+int backgroundLayer(std::vector<potrace_bitmap_uniqptr> const &layers,
+                    int turdsize) {
+  int last = -1;
+  for (int i = 0; i < (int)layers.size(); i++) {
+    if (layers[i] && !bm_isclear(layers[i].get())) {
+      last = i;
+    }
+  }
+  if (last <= 0 || !Potrace::bitmapHasRun(layers[last].get(), turdsize)) {
+    return -1;
+  }
+  for (int i = 0; i < last; i++) {
+    if (layers[i] && Potrace::bitmapHasRun(layers[i].get(), turdsize)) {
+      return last;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Passes items on to a sink, holding back the latest one while it may still
+ * turn out to be the bottom-most scan that multiScanRemoveBackground drops.
+ */
+class BackgroundFilter {
+public:
+  BackgroundFilter(TraceItemSink const &sink, bool removeBackground)
+      : sink(sink), removeBackground(removeBackground) {}
+
+  void push(TraceResultItem &&item) {
+    if (!removeBackground) {
+      sink(std::move(item));
+      return;
+    }
+    if (count++ > 0) {
+      sink(std::exchange(pending, std::move(item)));
+    } else {
+      pending = std::move(item);
+    }
+  }
+
+  // Emit what is held back, unless it is the background
+  void finish() {
+    if (count == 1) {
+      sink(std::move(pending));
+    }
+    count = 0;
+  }
+
+private:
+  TraceItemSink const &sink;
+  bool removeBackground;
+  TraceResultItem pending{{}, {}}; // valid once count > 0
+  int count = 0;
+};
+
+// 收集全部结果项
+TraceResult collect(std::function<void(TraceItemSink const &)> const &trace) {
+  TraceResult results;
+  trace([&](TraceResultItem &&item) {
+    results.items.push_back(std::move(item));
+  });
+  return results;
+}
 
 // 十六进制字符串
 std::string twohex(int value) {
@@ -55,12 +256,7 @@ PotraceTracingEngine::PotraceTracingEngine(
 
 // 初始化
 void PotraceTracingEngine::common_init() {
-  potraceParams = potrace_param_default();
-}
-
-// 析构函数
-PotraceTracingEngine::~PotraceTracingEngine() {
-  potrace_param_free(potraceParams);
+  potraceParams = potrace_param_uniqptr(potrace_param_default());
 }
 
 // 设置优化曲线
@@ -83,6 +279,22 @@ void PotraceTracingEngine::setTurdSize(int turdsize) {
   potraceParams->turdsize = turdsize;
 }
 
+// 设置量化选项
+void PotraceTracingEngine::setQuantizeOptions(QuantizeOptions const &options) {
+  quantizeOptions = options;
+}
+
+// 设置追踪线程数
+void PotraceTracingEngine::setTraceThreads(int threads) {
+  traceThreads = threads;
+}
+
+// 设置位图预处理
+void PotraceTracingEngine::setBitmapCleanup(TraceType type,
+                                            BitmapCleanup const &cleanup) {
+  cleanups[type] = cleanup;
+}
+
 /**
  * Recursively descend the potrace_path_t node tree \a paths, writing paths to
  * \a builder. The \a points set is used to prevent redundant paths.
@@ -91,8 +303,9 @@ void PotraceTracingEngine::setTurdSize(int turdsize) {
  * 递归遍历 potrace_path_t 节点树 \a paths, 直接写入 SVG 路径字符串.
  * 这比原来的几何转换方式快得多！
  */
-void PotraceTracingEngine::writePathsToSvg(potrace_path_t *paths, 
-                                          std::ostringstream &out) const {
+void PotraceTracingEngine::writePathsToSvg(potrace_path_t *paths,
+                                          std::ostringstream &out,
+                                          int dx, int dy) const {
   std::unordered_set<std::string> processedPaths; // 防止重复路径
   
   for (auto path = paths; path; path = path->sibling) {
@@ -106,8 +319,8 @@ void PotraceTracingEngine::writePathsToSvg(potrace_path_t *paths,
     
     // 移动到起始点
     auto seg = curve.c[curve.n - 1];
-    pathStr << "M" << std::fixed << std::setprecision(2) 
-            << seg[2].x << "," << seg[2].y;
+    pathStr << "M" << std::fixed << std::setprecision(2)
+            << seg[2].x + dx << "," << seg[2].y + dy;
 
     // 处理所有曲线段
     for (int i = 0; i < curve.n; i++) {
@@ -115,14 +328,14 @@ void PotraceTracingEngine::writePathsToSvg(potrace_path_t *paths,
       switch (curve.tag[i]) {
       case POTRACE_CORNER:
         // 直线段：两个 lineTo 命令
-        pathStr << "L" << seg[1].x << "," << seg[1].y
-                << "L" << seg[2].x << "," << seg[2].y;
+        pathStr << "L" << seg[1].x + dx << "," << seg[1].y + dy
+                << "L" << seg[2].x + dx << "," << seg[2].y + dy;
         break;
       case POTRACE_CURVETO:
         // 贝塞尔曲线：curveTo 命令
-        pathStr << "C" << seg[0].x << "," << seg[0].y << " "
-                << seg[1].x << "," << seg[1].y << " "
-                << seg[2].x << "," << seg[2].y;
+        pathStr << "C" << seg[0].x + dx << "," << seg[0].y + dy << " "
+                << seg[1].x + dx << "," << seg[1].y + dy << " "
+                << seg[2].x + dx << "," << seg[2].y + dy;
         break;
       default:
         break;
@@ -139,21 +352,22 @@ void PotraceTracingEngine::writePathsToSvg(potrace_path_t *paths,
 
     // 递归处理子路径
     if (path->childlist) {
-      writePathsToSvg(path->childlist, out);
+      writePathsToSvg(path->childlist, out, dx, dy);
     }
   }
 }
 
 // 过滤
 std::optional<GrayMap>
-PotraceTracingEngine::filter(RgbMap const &rgbmap) const {
+PotraceTracingEngine::filter(RgbMap const &rgbmap, double threshold,
+                             double floor) const {
   std::optional<GrayMap> map;
 
   if (traceType == TraceType::QUANT) {
     // Color quantization -- banding
 
     // rgbMap->writePPM(rgbMap, "rgb.ppm");
-    map = quantizeBand(rgbmap, quantizationNrColors);
+    map = quantizeBand(rgbmap, quantizationNrColors, quantizeOptions);
 
   } else if (traceType == TraceType::BRIGHTNESS ||
              traceType == TraceType::BRIGHTNESS_MULTI) {
@@ -161,12 +375,12 @@ PotraceTracingEngine::filter(RgbMap const &rgbmap) const {
     auto gm = rgbMapToGrayMap(rgbmap);
     map = GrayMap(gm.width, gm.height);
 
-    double floor = 3.0 * brightnessFloor * 256.0;
-    double cutoff = 3.0 * brightnessThreshold * 256.0;
+    double low = 3.0 * floor * 256.0;
+    double cutoff = 3.0 * threshold * 256.0;
     for (int y = 0; y < gm.height; y++) {
       for (int x = 0; x < gm.width; x++) {
         double brightness = gm.getPixel(x, y);
-        bool black = brightness >= floor && brightness < cutoff;
+        bool black = brightness >= low && brightness < cutoff;
         map->setPixel(x, y, black ? GrayMap::BLACK : GrayMap::WHITE);
       }
     }
@@ -197,31 +411,26 @@ PotraceTracingEngine::filter(RgbMap const &rgbmap) const {
 // 过滤索引
 IndexedMap PotraceTracingEngine::filterIndexed(RgbMap const &rgbmap) const {
 
-  auto map = rgbmap;
+  // Only smoothing needs pixels of its own
+  std::optional<RgbMap> smoothed;
   if (multiScanSmooth) {
-    map = rgbMapGaussian(map);
+    smoothed = rgbMapGaussian(rgbmap);
   }
 
-  auto imap = rgbMapQuantize(map, multiScanNrColors);
-
-  auto tomono = [](RGB c) -> RGB {
-    unsigned char s = ((int)c.r + (int)c.g + (int)c.b) / 3;
-    return {s, s, s};
-  };
+  auto imap = rgbMapQuantize(smoothed ? *smoothed : rgbmap, multiScanNrColors,
+                             quantizeOptions);
 
   if (traceType == TraceType::QUANT_MONO ||
       traceType == TraceType::BRIGHTNESS_MULTI) {
     // Turn to grays
-    for (auto &c : imap.clut) {
-      c = tomono(c);
-    }
+    clutToMono(imap.clut);
   }
 
   return imap;
 }
 
 // 预览
-RgbMap PotraceTracingEngine::preview(RgbMap const &rgbmap) {
+RgbMap PotraceTracingEngine::preview(RgbMap const &rgbmap) const {
   if (traceType == TraceType::QUANT_COLOR ||
       traceType == TraceType::QUANT_MONO ||
       traceType ==
@@ -233,7 +442,8 @@ RgbMap PotraceTracingEngine::preview(RgbMap const &rgbmap) {
     return indexedMapToRgbMap(imap);
 
   } else {
-    auto gm = filter(rgbmap);
+    // Same band as traceSingle()
+    auto gm = filter(rgbmap, brightnessThreshold, 0.0);
     if (!gm) {
       return RgbMap(0, 0);
     }
@@ -247,52 +457,291 @@ RgbMap PotraceTracingEngine::preview(RgbMap const &rgbmap) {
  * 直接返回 SVG 路径字符串
  */
 // 灰度图直接转 SVG 字符串
-std::string PotraceTracingEngine::grayMapToSvg(GrayMap const &grayMap) {
-  auto potraceBitmap =
-      potrace_bitmap_uniqptr(bm_new(grayMap.width, grayMap.height));
+std::string PotraceTracingEngine::grayMapToSvg(GrayMap const &grayMap) const {
+  auto potraceBitmap = grayMapToBitmap(grayMap);
   if (!potraceBitmap) {
     return "";
   }
 
-  bm_clear(potraceBitmap.get(), 0);
+  return bitmapToSvg(potraceBitmap.get());
+}
 
-  // Read the data out of the GrayMap
+// 灰度图转位图
+potrace_bitmap_uniqptr
+PotraceTracingEngine::grayMapToBitmap(GrayMap const &grayMap) const {
+  auto potraceBitmap =
+      potrace_bitmap_uniqptr(bm_new(grayMap.width, grayMap.height));
+  if (!potraceBitmap) {
+    return nullptr;
+  }
+
+  // Read the data out of the GrayMap, every word is written once
+  int const dy = potraceBitmap->dy;
   for (int y = 0; y < grayMap.height; y++) {
-    for (int x = 0; x < grayMap.width; x++) {
-      BM_UPUT(potraceBitmap, x, y, grayMap.getPixel(x, y) ? 0 : 1);
+    auto src = grayMap.row(y);
+    auto line = bm_scanline(potraceBitmap.get(), y);
+    for (int k = 0; k < dy; k++) {
+      int const x0 = k * BM_WORDBITS;
+      int const n = std::min(BM_WORDBITS, grayMap.width - x0);
+      potrace_word word = 0;
+      for (int i = 0; i < n; i++) {
+        word |= (potrace_word)(src[x0 + i] == 0) << (BM_WORDBITS - 1 - i);
+      }
+      line[k] = word;
+    }
+  }
+
+  return potraceBitmap;
+}
+
+/**
+ * Threshold an RGB image straight into a potrace bitmap: gray value,
+ * brightness band, inversion and transparency in a single pass, without
+ * the GrayMaps in between. The bit of every pixel sum r + g + b comes from a table, and
+ * bits are packed a word at a time.
+ */
+// 亮度阈值直接转位图
+potrace_bitmap_uniqptr
+PotraceTracingEngine::brightnessBitmap(RgbMap const &rgbmap, double threshold,
+                                       double floor) const {
+  auto bm = potrace_bitmap_uniqptr(bm_new(rgbmap.width, rgbmap.height));
+  if (!bm) {
+    return nullptr;
+  }
+
+  // Same arithmetic as rgbMapToGrayMap() and filter()
+  double const low = 3.0 * floor * 256.0;
+  double const cutoff = 3.0 * threshold * 256.0;
+  std::array<potrace_word, 3 * 255 + 1> bit;
+  for (int sum = 0; sum < (int)bit.size(); sum++) {
+    unsigned long brightness = sum * 255 / 256;
+    bool black = brightness >= low && brightness < cutoff;
+    bit[sum] = black != invert;
+  }
+
+  int const width = rgbmap.width;
+  int const height = rgbmap.height;
+  int const dy = bm->dy;
+  // Fully transparent pixels are never set
+  auto alpha = rgbmap.hasAlpha() ? rgbmap.alpha.data() : nullptr;
+  Parallel::forChunks(
+      height, Parallel::chunkCount(height, traceThreads, 64),
+      [&](int, int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+          auto src = rgbmap.row(y);
+          auto line = bm_scanline(bm.get(), y);
+          for (int k = 0; k < dy; k++) {
+            int const x0 = k * BM_WORDBITS;
+            int const n = std::min(BM_WORDBITS, width - x0);
+            potrace_word word = 0;
+            for (int i = 0; i < n; i++) {
+              auto const &p = src[x0 + i];
+              word |= bit[p.r + p.g + p.b] << (BM_WORDBITS - 1 - i);
+            }
+            if (alpha) {
+              for (int i = 0; i < n; i++) {
+                if (!alpha[y * (size_t)width + x0 + i]) {
+                  word &= ~(BM_HIBIT >> i);
+                }
+              }
+            }
+            line[k] = word;
+          }
+        }
+      });
+
+  return bm;
+}
+
+// 位图直接转 SVG 字符串
+std::string PotraceTracingEngine::bitmapToSvg(potrace_bitmap_t *bitmap) const {
+  prepareBitmap(bitmap);
+  return traceBitmap(bitmap);
+}
+
+// 位图预处理
+void PotraceTracingEngine::prepareBitmap(potrace_bitmap_t *bitmap) const {
+  // Clean the bitmap up before potrace has to find every speck
+  auto cleanup = cleanups.find(traceType);
+  if (cleanup != cleanups.end() && cleanup->second.enabled()) {
+    bitmapCleanup(bitmap, cleanup->second, traceThreads);
+  }
+}
+
+// 追踪预处理过的位图
+std::string
+PotraceTracingEngine::traceBitmap(potrace_bitmap_t const *bitmap) const {
+  // Nothing to trace
+  if (bm_isclear(bitmap)) {
+    return "";
+  }
+
+  // The whole canvas is a plain rectangle
+  if (bm_isfull(bitmap)) {
+    if ((long)bitmap->w * bitmap->h <= potraceParams->turdsize) {
+      return "";
     }
+    std::ostringstream svgPath;
+    svgPath << std::fixed << std::setprecision(2)
+            << "M" << 0.0 << "," << 0.0
+            << "L" << (double)bitmap->w << "," << 0.0
+            << "L" << (double)bitmap->w << "," << (double)bitmap->h
+            << "L" << 0.0 << "," << (double)bitmap->h << "Z";
+    return svgPath.str();
+  }
+
+  bool const invariant = translationInvariant();
+  if (traceThreads != 1 && invariant) {
+    return bitmapToSvgByComponents(bitmap);
+  }
+
+  // Only the part with pixels in it goes to potrace, so margins cost
+  // nothing; the paths are moved back into place when written
+  auto box = occupiedBox(bitmap);
+  potrace_bitmap_uniqptr crop;
+  if (invariant && (box.x1 - box.x0 < bitmap->w || box.y1 - box.y0 < bitmap->h)) {
+    crop = cropBitmap(bitmap, box);
   }
+  if (!crop) {
+    box = {0, 0, bitmap->w, bitmap->h};
+  }
+
   // Trace the bitmap.
 
   // Progress reporting removed
-  auto potraceState =
-      potrace_state_uniqptr(potrace_trace(potraceParams, potraceBitmap.get()));
-
-  potraceBitmap.reset();
+  auto potraceState = potrace_state_uniqptr(
+      potrace_trace(potraceParams.get(), crop ? crop.get() : bitmap));
+  if (!potraceState) {
+    return "";
+  }
 
   // 直接提取 SVG 路径字符串！
   std::ostringstream svgPath;
-  writePathsToSvg(potraceState->plist, svgPath);
+  writePathsToSvg(potraceState->plist, svgPath, box.x0, box.y0);
   return svgPath.str();
 }
 
 /**
- * This is called for a single scan.
+ * Potrace decides ambiguous turns from the pixels around them, except under
+ * POTRACE_TURNPOLICY_RANDOM, which hashes their absolute coordinates. Only
+ * without it does tracing a part of a bitmap, moved back into place, give
+ * the paths a trace of the whole would.
  */
-// 单
-TraceResult PotraceTracingEngine::traceSingle(RgbMap const &rgbmap) {
-  brightnessFloor = 0.0; // important to set this, since used by filter()
+bool PotraceTracingEngine::translationInvariant() const {
+  return potraceParams->turnpolicy != POTRACE_TURNPOLICY_RANDOM;
+}
+
+/**
+ * Trace the independent components of a bitmap concurrently. Small
+ * neighbouring components are bucketed so that each potrace call has enough
+ * work, and the paths are concatenated in bucket order, which keeps the
+ * output deterministic. The paths are the same as those of a single call,
+ * only their order differs, which does not change the filled area; this
+ * needs a translationInvariant() engine, the caller checks.
+ */
+// 按连通分量并行追踪
+std::string
+PotraceTracingEngine::bitmapToSvgByComponents(
+    potrace_bitmap_t const *bitmap) const {
+  int const nrThreads = Parallel::threadCount(traceThreads);
+  auto components = bitmapComponents(bitmap, nrThreads);
+  if (components.empty()) {
+    return "";
+  }
 
-  auto grayMap = filter(rgbmap);
-  if (!grayMap) {
-    return {};
+  // Group consecutive components into buckets of similar area
+  struct Bucket {
+    int first, last; // components [first, last)
+    int x0, y0, x1, y1;
+    long area;
+  };
+  long total = 0;
+  for (auto const &c : components) {
+    total += c.area;
+  }
+  long const target = std::max(total / (nrThreads * 8L), 4096L);
+  long const maxBox = std::max(16 * target, 1L << 16);
+
+  std::vector<Bucket> buckets;
+  for (int i = 0; i < (int)components.size(); i++) {
+    auto const &c = components[i];
+    if (!buckets.empty()) {
+      auto &b = buckets.back();
+      long box = (long)(std::max(b.x1, c.x1) - std::min(b.x0, c.x0)) *
+                 (std::max(b.y1, c.y1) - std::min(b.y0, c.y0));
+      if (b.area + c.area <= target && box <= maxBox) {
+        b.last = i + 1;
+        b.x0 = std::min(b.x0, c.x0);
+        b.y0 = std::min(b.y0, c.y0);
+        b.x1 = std::max(b.x1, c.x1);
+        b.y1 = std::max(b.y1, c.y1);
+        b.area += c.area;
+        continue;
+      }
+    }
+    buckets.push_back({i, i + 1, c.x0, c.y0, c.x1, c.y1, c.area});
   }
 
-  auto svgPath = grayMapToSvg(*grayMap);
+  std::vector<std::string> paths(buckets.size());
+  Parallel::forItems(buckets.size(), nrThreads, [&](int i) {
+    auto const &b = buckets[i];
+    auto bm = potrace_bitmap_uniqptr(bm_new(b.x1 - b.x0, b.y1 - b.y0));
+    if (!bm) {
+      return;
+    }
+    bm_clear(bm.get(), 0);
+    for (int k = b.first; k < b.last; k++) {
+      for (auto const &run : components[k].runs) {
+        bm_setrange(bm.get(), run.y - b.y0, run.x0 - b.x0, run.x1 - b.x0);
+      }
+    }
 
-  TraceResult results;
-  results.items.emplace_back("fill:#000000", std::move(svgPath));
-  return results;
+    auto potraceState =
+        potrace_state_uniqptr(potrace_trace(potraceParams.get(), bm.get()));
+    bm.reset();
+    if (!potraceState) {
+      return;
+    }
+
+    std::ostringstream svgPath;
+    writePathsToSvg(potraceState->plist, svgPath, b.x0, b.y0);
+    paths[i] = svgPath.str();
+  });
+
+  std::string svgPath;
+  for (auto const &p : paths) {
+    svgPath += p;
+  }
+  return svgPath;
+}
+
+/**
+ * This is called for a single scan.
+ */
+// 单
+void PotraceTracingEngine::traceSingle(RgbMap const &rgbmap,
+                                       TraceItemSink const &sink) const {
+  std::string svgPath;
+  if (traceType == TraceType::BRIGHTNESS) {
+    // The floor is always black for a single scan
+    auto bitmap = brightnessBitmap(rgbmap, brightnessThreshold, 0.0);
+    if (bitmap) {
+      svgPath = bitmapToSvg(bitmap.get());
+    }
+  } else {
+    auto grayMap = filter(rgbmap, brightnessThreshold, 0.0);
+    if (!grayMap) {
+      return;
+    }
+    auto bitmap = grayMapToBitmap(*grayMap);
+    grayMap.reset();
+    if (bitmap) {
+      clearTransparent(bitmap.get(), rgbmap);
+      svgPath = bitmapToSvg(bitmap.get());
+    }
+  }
+
+  sink({"fill:#000000", std::move(svgPath)});
 }
 
 /**
@@ -300,7 +749,7 @@ TraceResult PotraceTracingEngine::traceSingle(RgbMap const &rgbmap) {
  * increasing performance.
  */
 // 追踪灰度图
-TraceResult PotraceTracingEngine::traceGrayMap(GrayMap const &grayMap) {
+TraceResult PotraceTracingEngine::traceGrayMap(GrayMap const &grayMap) const {
   auto svgPath = grayMapToSvg(grayMap);
 
   TraceResult results;
@@ -312,110 +761,232 @@ TraceResult PotraceTracingEngine::traceGrayMap(GrayMap const &grayMap) {
  * Called for multiple-scanning algorithms
  */
 // 亮度多
-TraceResult PotraceTracingEngine::traceBrightnessMulti(RgbMap const &rgbmap) {
+void PotraceTracingEngine::traceBrightnessMulti(
+    RgbMap const &rgbmap, TraceItemSink const &sink) const {
   double constexpr low = 0.2;  // bottom of range
   double constexpr high = 0.9; // top of range
   double const delta = (high - low) / multiScanNrColors;
 
-  brightnessFloor = 0.0; // Set bottom to black
+  double floor = 0.0; // Set bottom to black
 
-  TraceResult results;
+  if (multiScanStack) {
+    // Every layer is known up front, build them all before tracing
+    std::vector<potrace_bitmap_uniqptr> layers;
+    std::vector<std::string> styles;
+    for (int i = 0; i < multiScanNrColors; i++) {
+      double const threshold = low + delta * i;
+
+      // get style info
+      int grayVal = 256.0 * threshold;
+      styles.push_back("fill-opacity:1.0;fill:#" + twohex(grayVal) +
+                       twohex(grayVal) + twohex(grayVal));
+      layers.push_back(brightnessBitmap(rgbmap, threshold, floor));
+    }
+
+    traceLayers(layers, styles, sink);
+    return;
+  }
+
+  // Each floor depends on the previous layer's result, trace as we go
+  BackgroundFilter results(sink, multiScanRemoveBackground);
 
   for (int i = 0; i < multiScanNrColors; i++) {
 
-    brightnessThreshold = low + delta * i;
+    double const threshold = low + delta * i;
 
-    auto grayMap = filter(rgbmap);
-    if (!grayMap) {
+    auto bitmap = brightnessBitmap(rgbmap, threshold, floor);
+    if (!bitmap) {
       continue;
     }
 
-    auto svgPath = grayMapToSvg(*grayMap);
+    auto svgPath = bitmapToSvg(bitmap.get());
+    bitmap.reset();
     if (svgPath.empty()) {
       continue;
     }
 
     // get style info
-    int grayVal = 256.0 * brightnessThreshold;
+    int grayVal = 256.0 * threshold;
     auto style = "fill-opacity:1.0;fill:#" + twohex(grayVal) + twohex(grayVal) +
                  twohex(grayVal);
 
     // g_message("### GOT '%s' \n", style.c_str());
-    results.items.emplace_back(style, std::move(svgPath));
+    results.push({style, std::move(svgPath)});
 
     if (!multiScanStack) {
-      brightnessFloor = brightnessThreshold;
+      floor = threshold;
     }
   }
 
   // Remove the bottom-most scan, if requested.
-  if (results.items.size() > 1 && multiScanRemoveBackground) {
-    results.items.pop_back();
-  }
-
-  return results;
+  results.finish();
 }
 
 /**
  * Quantization
  */
 // 量化
-TraceResult PotraceTracingEngine::traceQuant(RgbMap const &rgbmap) {
-  auto imap = filterIndexed(rgbmap);
+void PotraceTracingEngine::traceQuant(RgbMap const &rgbmap,
+                                      QuantizeOptions const &options,
+                                      TraceItemSink const &sink,
+                                      ColorTable *palette) const {
+  std::optional<RgbMap> smoothed;
+  if (multiScanSmooth) {
+    smoothed = rgbMapGaussian(rgbmap);
+  }
+
+  // Quantize and split into one bitmap per color in a single pass
+  LayerSink layers(multiScanStack, rgbmap);
+  auto table = rgbMapQuantize(smoothed ? *smoothed : rgbmap, multiScanNrColors,
+                              layers, options);
+  smoothed.reset();
+  if (palette) {
+    *palette = table;
+  }
 
-  // Create and clear a gray map
-  auto gm = GrayMap(imap.width, imap.height);
-  for (int row = 0; row < gm.height; row++) {
-    for (int col = 0; col < gm.width; col++) {
-      gm.setPixel(col, row, GrayMap::WHITE);
+  if (traceType == TraceType::QUANT_MONO) {
+    // Turn to grays
+    clutToMono(table.clut);
+  }
+
+  // get style info
+  std::vector<std::string> styles;
+  for (int colorIndex = 0; colorIndex < (int)layers.layers.size(); colorIndex++) {
+    auto rgb = table.clut[colorIndex];
+    styles.push_back("fill:#" + twohex(rgb.r) + twohex(rgb.g) + twohex(rgb.b));
+  }
+
+  traceLayers(layers.layers, styles, sink);
+}
+
+/**
+ * Trace the layers of a multiple scan, bottom-most last, handing each to
+ * <sink> as soon as it is traced. When the background is to be removed and
+ * the layer it would drop can be told from the bitmaps alone, that layer is
+ * never traced.
+ */
+// 多层追踪
+void PotraceTracingEngine::traceLayers(
+    std::vector<potrace_bitmap_uniqptr> &layers,
+    std::vector<std::string> const &styles, TraceItemSink const &sink) const {
+  for (auto &layer : layers) {
+    if (layer) {
+      prepareBitmap(layer.get());
     }
   }
 
-  TraceResult results;
+  int skip = -1;
+  if (multiScanRemoveBackground) {
+    skip = backgroundLayer(layers, potraceParams->turdsize);
+  }
 
-  for (int colorIndex = 0; colorIndex < imap.nrColors; colorIndex++) {
+  // Without a known background layer, hold back the bottom-most scan
+  BackgroundFilter results(sink, skip < 0 && multiScanRemoveBackground);
 
-    // Update the graymap for the current color index
-    for (int row = 0; row < imap.height; row++) {
-      for (int col = 0; col < imap.width; col++) {
-        int index = imap.getPixel(col, row);
-        if (index == colorIndex) {
-          gm.setPixel(col, row, GrayMap::BLACK);
-        } else if (!multiScanStack) {
-          gm.setPixel(col, row, GrayMap::WHITE);
-        }
-      }
+  for (int i = 0; i < (int)layers.size(); i++) {
+    if (!layers[i] || i == skip) {
+      layers[i].reset();
+      continue;
     }
 
-    // Now we have a traceable graymap
-    auto svgPath = grayMapToSvg(gm);
+    // Now we have a traceable bitmap
+    auto svgPath = traceBitmap(layers[i].get());
+    layers[i].reset();
 
     if (!svgPath.empty()) {
-      // get style info
-      auto rgb = imap.clut[colorIndex];
-      auto style = "fill:#" + twohex(rgb.r) + twohex(rgb.g) + twohex(rgb.b);
-      results.items.emplace_back(style, std::move(svgPath));
+      results.push({styles[i], std::move(svgPath)});
     }
   }
 
-  // Remove the bottom-most scan, if requested.
-  if (results.items.size() > 1 && multiScanRemoveBackground) {
-    results.items.pop_back();
+  // Remove the bottom-most scan, if requested and not skipped already.
+  results.finish();
+}
+
+// 追踪
+TraceResult PotraceTracingEngine::trace(RgbMap const &rgbmap) const {
+  return collect([&](TraceItemSink const &sink) { traceStream(rgbmap, sink); });
+}
+
+/**
+ * Fully transparent pixels are never traced, so an image with a transparent
+ * surround is cropped to its opaque part, plus a margin, and the paths are
+ * moved back into place. Not when that would change the paths, see
+ * translationInvariant().
+ */
+// 逐层追踪
+void PotraceTracingEngine::traceStream(RgbMap const &rgbmap,
+                                       TraceItemSink const &sink) const {
+  if (rgbmap.hasAlpha() && translationInvariant()) {
+    auto box = rgbMapOpaqueBox(rgbmap);
+    if (box.empty()) {
+      return;
+    }
+    box = {std::max(box.x0 - CROP_MARGIN, 0), std::max(box.y0 - CROP_MARGIN, 0),
+           std::min(box.x1 + CROP_MARGIN, rgbmap.width),
+           std::min(box.y1 + CROP_MARGIN, rgbmap.height)};
+    if (box.x0 > 0 || box.y0 > 0 || box.x1 < rgbmap.width ||
+        box.y1 < rgbmap.height) {
+      auto cropped = rgbMapCrop(rgbmap, box);
+      traceRegion(cropped, [&](TraceResultItem &&item) {
+        sink(translateTraceItem(item, box.x0, box.y0));
+      });
+      return;
+    }
   }
 
-  return results;
+  traceRegion(rgbmap, sink);
 }
 
-// 追踪
-TraceResult PotraceTracingEngine::trace(RgbMap const &rgbmap) {
+// 追踪 (已裁剪)
+void PotraceTracingEngine::traceRegion(RgbMap const &rgbmap,
+                                       TraceItemSink const &sink) const {
   if (traceType == TraceType::QUANT_COLOR ||
       traceType == TraceType::QUANT_MONO) {
-    return traceQuant(rgbmap);
+    traceQuant(rgbmap, quantizeOptions, sink);
   } else if (traceType == TraceType::BRIGHTNESS_MULTI) {
-    return traceBrightnessMulti(rgbmap);
+    traceBrightnessMulti(rgbmap, sink);
   } else {
-    return traceSingle(rgbmap);
+    traceSingle(rgbmap, sink);
+  }
+}
+
+/**
+ * Progressive trace. For color quantization the full resolution pass maps
+ * onto the palette of the coarse pass, so that colors and layer order do
+ * not change between the two.
+ */
+// 渐进追踪
+TraceResult
+PotraceTracingEngine::traceProgressive(RgbMap const &rgbmap,
+                                       TraceCallback const &onResult,
+                                       ProgressiveOptions const &options) const {
+  bool const quant = traceType == TraceType::QUANT_COLOR ||
+                     traceType == TraceType::QUANT_MONO;
+  if (!quant || !options.stablePalette || quantizeOptions.palette) {
+    return TracingEngine::traceProgressive(rgbmap, onResult, options);
   }
+
+  auto coarse =
+      rgbMapReduce(rgbmap, options.coarsePixels, quantizeOptions.nrThreads);
+  if (!coarse) {
+    return TracingEngine::traceProgressive(rgbmap, onResult, options);
+  }
+
+  auto palette = std::make_shared<ColorTable>();
+  auto preview = collect([&](TraceItemSink const &sink) {
+    traceQuant(*coarse, quantizeOptions, sink, palette.get());
+  });
+  onResult(scaleTraceResult(preview, (double)rgbmap.width / coarse->width,
+                            (double)rgbmap.height / coarse->height),
+           false);
+
+  auto refined = quantizeOptions;
+  refined.palette = std::move(palette);
+  auto result = collect([&](TraceItemSink const &sink) {
+    traceQuant(rgbmap, refined, sink);
+  });
+  onResult(result, true);
+  return result;
 }
 
 } // namespace Potrace
@@ -11,6 +11,10 @@
  * Released under GNU GPL v2+, read the file 'COPYING' for more information.
  */
 #include "filters/filterset.h"
+#include "core/cpu/kernels.h"
+
+#include <algorithm>
+#include <cstdint>
 
 
 
@@ -18,15 +22,10 @@
 ### G A U S S I A N  (smoothing)
 #########################################################################*/
 
-static int gaussMatrix[] =
-{
-    2,  4,  5,  4, 2,
-    4,  9, 12,  9, 4,
-    5, 12, 15, 12, 5,
-    4,  9, 12,  9, 4,
-    2,  4,  5,  4, 2
-};
-
+/**
+ * A block whose 2 pixel surroundings hold a single value blurs to that
+ * same value, so only blocks with something in them are filtered.
+ */
 GrayMap grayMapGaussian(GrayMap const &me) // Todo: Make member function, keep implementation here
 {
     int width  = me.width;
@@ -37,75 +36,102 @@ GrayMap grayMapGaussian(GrayMap const &me) // Todo: Make member function, keep i
     int lastY  = height - 3;
 
     auto newGm = GrayMap(width, height);
+    auto tiles = grayMapTiles(me, 2);
+    int constexpr T = GrayTiles::TILE;
 
     for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            // image boundaries
-            if (x < firstX || x > lastX || y < firstY || y > lastY) {
-                newGm.setPixel(x, y, me.getPixel(x, y));
+        int const row = y / T;
+        for (int col = 0; col < tiles.cols; col++) {
+            int const x0 = col * T;
+            int x1 = std::min(x0 + T, width);
+
+            auto const value = tiles.lo[tiles.index(col, row)];
+            if (tiles.uniform(col, row) && value <= GrayMap::WHITE) {
+                std::fill(newGm.row(y) + x0, newGm.row(y) + x1, value);
                 continue;
             }
 
-            // all other pixels
-            int gaussIndex = 0;
-            unsigned long sum = 0;
-            for (int i = y - 2; i <= y + 2; i++) {
-                for (int j = x - 2; j <= x + 2; j++) {
-                    int weight = gaussMatrix[gaussIndex++];
-                    sum += me.getPixel(j, i) * weight;
+            // run on through the following blocks that need the filter too
+            while (col + 1 < tiles.cols && !tiles.uniform(col + 1, row)) {
+                col++;
+                x1 = std::min(x1 + T, width);
+            }
+            for (int x = x0; x < x1; x++) {
+                // image boundaries
+                if (x < firstX || x > lastX || y < firstY || y > lastY) {
+                    newGm.setPixel(x, y, me.getPixel(x, y));
+                    continue;
+                }
+
+                // all other pixels
+                int gaussIndex = 0;
+                unsigned long sum = 0;
+                for (int i = y - 2; i <= y + 2; i++) {
+                    for (int j = x - 2; j <= x + 2; j++) {
+                        int weight = Kernels::GAUSS_WEIGHTS[gaussIndex++];
+                        sum += me.getPixel(j, i) * weight;
+                    }
                 }
+                sum /= 159;
+                sum = std::min(sum, GrayMap::WHITE);
+                newGm.setPixel(x, y, sum);
             }
-            sum /= 159;
-            sum = std::min(sum, GrayMap::WHITE);
-            newGm.setPixel(x, y, sum);
         }
     }
 
     return newGm;
 }
 
+/**
+ * The RGB version reads a planar copy of the source, a block of contiguous
+ * bytes of one channel at a time, which compiles to SIMD code. Results are
+ * the same as filtering pixel by pixel.
+ */
 RgbMap rgbMapGaussian(RgbMap const &me)
+{
+    return rgbMapGaussian(RgbMap(me));
+}
+
+/**
+ * Filtered blocks go straight back into the storage of <me>, which already
+ * holds the image boundaries and alpha, so the planar source is the only
+ * other image in memory.
+ */
+RgbMap rgbMapGaussian(RgbMap &&me)
 {
     int width  = me.width;
     int height = me.height;
-    int firstX = 2;
-    int lastX  = width-3;
-    int firstY = 2;
-    int lastY  = height-3;
-
-    auto newGm = RgbMap(width, height);
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            // image boundaries
-            if (x < firstX || x > lastX || y < firstY || y > lastY) {
-                newGm.setPixel(x, y, me.getPixel(x, y));
-                continue;
-            }
+    if (width < 5 || height < 5) {
+        // all pixels are on the image boundaries
+        return std::move(me);
+    }
 
-            // all other pixels
-            int gaussIndex = 0;
-            int sumR       = 0;
-            int sumG       = 0;
-            int sumB       = 0;
-            for (int i = y - 2; i <= y + 2; i++) {
-                for (int j = x - 2; j <= x + 2; j++) {
-                    int weight = gaussMatrix[gaussIndex++];
-                    RGB rgb = me.getPixel(j, i);
-                    sumR += weight * rgb.r;
-                    sumG += weight * rgb.g;
-                    sumB += weight * rgb.b;
+    auto planes = rgbMapToPlanar(me);
+    unsigned char RGB::*const channels[] = {&RGB::r, &RGB::g, &RGB::b};
+    int constexpr GAUSS_BLOCK = Kernels::GAUSS_BLOCK;
+    unsigned char block[GAUSS_BLOCK];
+    auto const gaussBlock = Kernels::table().gaussBlock;
+
+    for (int y = 2; y < height - 2; y++) {
+        auto dst = me.row(y);
+        for (int x = 2; x < width - 2; x += GAUSS_BLOCK) {
+            int const n = std::min(GAUSS_BLOCK, width - 2 - x);
+            for (int c = 0; c < 3; c++) {
+                unsigned char const *lines[5];
+                for (int i = 0; i < 5; i++) {
+                    lines[i] = planes.row(c, y + i - 2) + x;
                 }
-	        }
-            RGB rout;
-            rout.r = (sumR / 159) & 0xff;
-            rout.g = (sumG / 159) & 0xff;
-            rout.b = (sumB / 159) & 0xff;
-            newGm.setPixel(x, y, rout);
-	    }
-	}
+                gaussBlock(lines, n, block);
+                auto const channel = channels[c];
+                for (int i = 0; i < n; i++) {
+                    dst[x + i].*channel = block[i];
+                }
+            }
+        }
+    }
 
-    return newGm;
+    return std::move(me);
 }
 
 /*#########################################################################
@@ -127,7 +153,9 @@ static int sobelY[] =
 };
 
 /**
- * Perform Sobel convolution on a GrayMap.
+ * Perform Sobel convolution on a GrayMap. Away from the image boundaries,
+ * every pixel of a block whose 1 pixel surroundings hold a single value
+ * gets the same result, which is worked out once per block.
  */
 GrayMap grayMapCanny(GrayMap const &gm, double dLowThreshold, double dHighThreshold)
 {
@@ -140,95 +168,126 @@ GrayMap grayMapCanny(GrayMap const &gm, double dLowThreshold, double dHighThresh
 
     auto map = GrayMap(width, height);
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            bool edge;
-            // image boundaries
-            if (x < firstX || x > lastX || y < firstY || y > lastY) {
-                edge = false;
-            } else {
-                // SOBEL FILTERING
-                long sumX = 0;
-                long sumY = 0;
-                int sobelIndex = 0;
-                for (int i = y-1; i <= y + 1; i++) {
-                    for (int j = x - 1; j <= x + 1; j++) {
-                        sumX += gm.getPixel(j, i) * sobelX[sobelIndex++];
-                    }
+    unsigned long const highThreshold = dHighThreshold * GrayMap::WHITE;
+    unsigned long const lowThreshold  = dLowThreshold  * GrayMap::WHITE;
+
+    auto edgeAt = [&](int x, int y) {
+        bool edge;
+        // image boundaries
+        if (x < firstX || x > lastX || y < firstY || y > lastY) {
+            edge = false;
+        } else {
+            // SOBEL FILTERING
+            long sumX = 0;
+            long sumY = 0;
+            int sobelIndex = 0;
+            for (int i = y-1; i <= y + 1; i++) {
+                for (int j = x - 1; j <= x + 1; j++) {
+                    sumX += gm.getPixel(j, i) * sobelX[sobelIndex++];
+                }
 	            }
 
-                sobelIndex = 0;
-                for (int i = y - 1; i <= y + 1; i++) {
-                    for (int j = x - 1; j <= x + 1; j++) {
-                        sumY += gm.getPixel(j, i) * sobelY[sobelIndex++];
-                    }
+            sobelIndex = 0;
+            for (int i = y - 1; i <= y + 1; i++) {
+                for (int j = x - 1; j <= x + 1; j++) {
+                    sumY += gm.getPixel(j, i) * sobelY[sobelIndex++];
+                }
 	            }
 
-                // GET VALUE
-                unsigned long sum = std::abs(sumX) + std::abs(sumY);
-                sum = std::min(sum, GrayMap::WHITE);
+            // GET VALUE
+            unsigned long sum = std::abs(sumX) + std::abs(sumY);
+            sum = std::min(sum, GrayMap::WHITE);
 
-                // GET EDGE DIRECTION (fast way)
-                int edgeDirection = 0; // x, y = 0
-                if (sumX == 0) {
-                    if (sumY != 0) {
-                        edgeDirection = 90;
-                    }
-                } else {
-                    long slope = sumY * 1024 / sumX;
-                    if (slope > 2472 || slope< -2472) { // tan(67.5) * 1024
-                        edgeDirection = 90;
-                    } else if (slope > 414) { // tan(22.5) * 1024
-                        edgeDirection = 45;
-                    } else if (slope < -414) { // -tan(22.5) * 1024
-                        edgeDirection = 135;
-                    }
+            // GET EDGE DIRECTION (fast way)
+            int edgeDirection = 0; // x, y = 0
+            if (sumX == 0) {
+                if (sumY != 0) {
+                    edgeDirection = 90;
                 }
-
-                // printf("%ld %ld %f %d\n", sumX, sumY, orient, edgeDirection);
-
-                // Get two adjacent pixels in edge direction
-                unsigned long leftPixel;
-                unsigned long rightPixel;
-                if (edgeDirection == 0) {
-                    leftPixel  = gm.getPixel(x - 1, y);
-                    rightPixel = gm.getPixel(x + 1, y);
-                } else if (edgeDirection == 45) {
-                    leftPixel  = gm.getPixel(x - 1, y + 1);
-                    rightPixel = gm.getPixel(x + 1, y - 1);
-                } else if (edgeDirection == 90) {
-                    leftPixel  = gm.getPixel(x, y - 1);
-                    rightPixel = gm.getPixel(x, y + 1);
-                } else { // 135
-                    leftPixel  = gm.getPixel(x - 1, y - 1);
-                    rightPixel = gm.getPixel(x + 1, y + 1);
+            } else {
+                long slope = sumY * 1024 / sumX;
+                if (slope > 2472 || slope< -2472) { // tan(67.5) * 1024
+                    edgeDirection = 90;
+                } else if (slope > 414) { // tan(22.5) * 1024
+                    edgeDirection = 45;
+                } else if (slope < -414) { // -tan(22.5) * 1024
+                    edgeDirection = 135;
                 }
+            }
 
-                // Compare current value to adjacent pixels. (If less than either, suppress it.)
-                if (sum < leftPixel || sum < rightPixel) {
+            // printf("%ld %ld %f %d\n", sumX, sumY, orient, edgeDirection);
+
+            // Get two adjacent pixels in edge direction
+            unsigned long leftPixel;
+            unsigned long rightPixel;
+            if (edgeDirection == 0) {
+                leftPixel  = gm.getPixel(x - 1, y);
+                rightPixel = gm.getPixel(x + 1, y);
+            } else if (edgeDirection == 45) {
+                leftPixel  = gm.getPixel(x - 1, y + 1);
+                rightPixel = gm.getPixel(x + 1, y - 1);
+            } else if (edgeDirection == 90) {
+                leftPixel  = gm.getPixel(x, y - 1);
+                rightPixel = gm.getPixel(x, y + 1);
+            } else { // 135
+                leftPixel  = gm.getPixel(x - 1, y - 1);
+                rightPixel = gm.getPixel(x + 1, y + 1);
+            }
+
+            // Compare current value to adjacent pixels. (If less than either, suppress it.)
+            if (sum < leftPixel || sum < rightPixel) {
+                edge = false;
+            } else {
+                if (sum >= highThreshold) {
+                    edge = true;
+                } else if (sum < lowThreshold) {
                     edge = false;
                 } else {
-                    unsigned long highThreshold = dHighThreshold * GrayMap::WHITE;
-                    unsigned long lowThreshold  = dLowThreshold  * GrayMap::WHITE;
-                    if (sum >= highThreshold) {
-                        edge = true;
-                    } else if (sum < lowThreshold) {
-                        edge = false;
-                    } else {
-                        edge = gm.getPixel(x - 1, y - 1) > highThreshold ||
-                               gm.getPixel(x    , y - 1) > highThreshold ||
-                               gm.getPixel(x + 1, y - 1) > highThreshold ||
-                               gm.getPixel(x - 1, y    ) > highThreshold ||
-                               gm.getPixel(x + 1, y    ) > highThreshold ||
-                               gm.getPixel(x - 1, y + 1) > highThreshold ||
-                               gm.getPixel(x    , y + 1) > highThreshold ||
-                               gm.getPixel(x + 1, y + 1) > highThreshold;
-                    }
+                    edge = gm.getPixel(x - 1, y - 1) > highThreshold ||
+                           gm.getPixel(x    , y - 1) > highThreshold ||
+                           gm.getPixel(x + 1, y - 1) > highThreshold ||
+                           gm.getPixel(x - 1, y    ) > highThreshold ||
+                           gm.getPixel(x + 1, y    ) > highThreshold ||
+                           gm.getPixel(x - 1, y + 1) > highThreshold ||
+                           gm.getPixel(x    , y + 1) > highThreshold ||
+                           gm.getPixel(x + 1, y + 1) > highThreshold;
                 }
             }
+        }
+        return edge;
+    };
+
+    auto tiles = grayMapTiles(gm, 1);
+    int constexpr T = GrayTiles::TILE;
 
-            // show edges as dark over light
-            map.setPixel(x, y, edge ? GrayMap::BLACK : GrayMap::WHITE);
+    for (int y = 0; y < height; y++) {
+        int const row = y / T;
+        for (int col = 0; col < tiles.cols; col++) {
+            int const x0 = col * T;
+
+            if (tiles.uniform(col, row) && y >= firstY && y <= lastY) {
+                // No gradient: the sum is 0 and both neighbours are the
+                // value, so only a black area can pass a high threshold of 0
+                int const x1 = std::min(x0 + T, width);
+                bool const edge = tiles.lo[tiles.index(col, row)] == 0 &&
+                                  highThreshold == 0;
+                for (int x = x0; x < x1; x++) {
+                    bool const inner = x >= firstX && x <= lastX;
+                    map.setPixel(x, y, inner && edge ? GrayMap::BLACK : GrayMap::WHITE);
+                }
+                continue;
+            }
+
+            // run on through the following blocks that need the filter too
+            int x1 = std::min(x0 + T, width);
+            while (col + 1 < tiles.cols && !tiles.uniform(col + 1, row)) {
+                col++;
+                x1 = std::min(x1 + T, width);
+            }
+            for (int x = x0; x < x1; x++) {
+                // show edges as dark over light
+                map.setPixel(x, y, edgeAt(x, y) ? GrayMap::BLACK : GrayMap::WHITE);
+            }
         }
     }
 
@@ -240,25 +299,26 @@ GrayMap grayMapCanny(GrayMap const &gm, double dLowThreshold, double dHighThresh
 ### Q U A N T I Z A T I O N
 #########################################################################*/
 
-GrayMap quantizeBand(RgbMap const &rgbMap, int nrColors)
+GrayMap quantizeBand(RgbMap const &rgbMap, int nrColors, QuantizeOptions const &options)
 {
     auto gaussMap = rgbMapGaussian(rgbMap);
     // gaussMap->writePPM(gaussMap, "rgbgauss.ppm");
 
-    auto qMap = rgbMapQuantize(gaussMap, nrColors);
+    auto qMap = rgbMapQuantize(gaussMap, nrColors, options);
     // qMap->writePPM(qMap, "rgbquant.ppm");
 
     auto gm = GrayMap(rgbMap.width, rgbMap.height);
 
-    // RGB is quantized. There should now be a small set of (R+G+B)
-    for (int y = 0; y < qMap.height; y++) {
-        for (int x = 0; x < qMap.width; x++) {
-            auto rgb = qMap.getPixelValue(x, y);
-            int sum = rgb.r + rgb.g + rgb.b;
-            auto result = (sum & 1) ? GrayMap::WHITE : GrayMap::BLACK;
-            // printf("%d %d %d : %d\n", rgb.r, rgb.g, rgb.b, index);
-            gm.setPixel(x, y, result);
-        }
+    // RGB is quantized. There should now be a small set of (R+G+B),
+    // so decide once per palette entry and map the indices through that
+    std::array<unsigned long, 256> band;
+    for (int i = 0; i < 256; i++) {
+        auto rgb = qMap.clut[i];
+        int sum = rgb.r + rgb.g + rgb.b;
+        band[i] = (sum & 1) ? GrayMap::WHITE : GrayMap::BLACK;
+    }
+    for (size_t i = 0; i < qMap.pixels.size(); i++) {
+        gm.pixels[i] = band[qMap.pixels[i]];
     }
 
     return gm;
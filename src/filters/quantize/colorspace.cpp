@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Perceptual color space conversion for quantization
+ *
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#include "filters/quantize/colorspace.h"
+#include "core/parallel/parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+
+/*
+-- conversion:
+
+- sRGB bytes go through a 256 entry table to linear light, the linear to
+  LMS matrix is applied, and the cube root comes from a table sampled on
+  [0,1] with linear interpolation. only the final LMS to Lab matrix and the
+  table lookups remain per pixel, and rows are converted in component
+  arrays so the matrix products vectorize.
+*/
+
+float constexpr SCALE = 255.0f;
+float constexpr A_OFFSET = 0.25f;  // a is within [-0.234, 0.276] for sRGB
+float constexpr B_OFFSET = 0.32f;  // b is within [-0.312, 0.199] for sRGB
+
+int constexpr CBRT_STEPS = 4096;
+
+float srgbToLinear(float c)
+{
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+float linearToSrgb(float c)
+{
+    return c <= 0.0031308f ? 12.92f * c : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+std::array<float, 256> const &linearTable()
+{
+    static auto const table = [] {
+        std::array<float, 256> t;
+        for (int i = 0; i < 256; i++) {
+            t[i] = srgbToLinear(i / 255.0f);
+        }
+        return t;
+    }();
+    return table;
+}
+
+std::array<float, CBRT_STEPS + 2> const &cbrtTable()
+{
+    static auto const table = [] {
+        std::array<float, CBRT_STEPS + 2> t;
+        for (int i = 0; i <= CBRT_STEPS + 1; i++) {
+            t[i] = std::cbrt(float(i) / CBRT_STEPS);
+        }
+        return t;
+    }();
+    return table;
+}
+
+/**
+ * cube root of a value in [0,1] from the interpolated table, the first step
+ * is too steep to interpolate and is computed exactly
+ */
+inline float cbrtLookup(std::array<float, CBRT_STEPS + 2> const &table, float v)
+{
+    float f = std::clamp(v, 0.0f, 1.0f) * CBRT_STEPS;
+    if (f < 1.0f) {
+        return std::cbrt(std::max(v, 0.0f));
+    }
+    int i = (int)f;
+    float t = f - i;
+    return table[i] + t * (table[i + 1] - table[i]);
+}
+
+inline unsigned char toByte(float v)
+{
+    return (unsigned char)std::clamp(v * SCALE + 0.5f, 0.0f, 255.0f);
+}
+
+/**
+ * convert <n> pixels of <src> to scaled Oklab into <dst>
+ */
+void rowToOklab(RGB const *src, RGB *dst, int n)
+{
+    int constexpr BATCH = 64;
+    auto const &lin = linearTable();
+    auto const &cbrt = cbrtTable();
+
+    float l[BATCH], m[BATCH], s[BATCH];
+    for (int x0 = 0; x0 < n; x0 += BATCH) {
+        int const count = std::min(BATCH, n - x0);
+        for (int i = 0; i < count; i++) {
+            float r = lin[src[x0 + i].r];
+            float g = lin[src[x0 + i].g];
+            float b = lin[src[x0 + i].b];
+            l[i] = 0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b;
+            m[i] = 0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b;
+            s[i] = 0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b;
+        }
+        for (int i = 0; i < count; i++) {
+            l[i] = cbrtLookup(cbrt, l[i]);
+            m[i] = cbrtLookup(cbrt, m[i]);
+            s[i] = cbrtLookup(cbrt, s[i]);
+        }
+        for (int i = 0; i < count; i++) {
+            float L = 0.2104542553f * l[i] + 0.7936177850f * m[i] - 0.0040720468f * s[i];
+            float A = 1.9779984951f * l[i] - 2.4285922050f * m[i] + 0.4505937099f * s[i];
+            float B = 0.0259040371f * l[i] + 0.7827717662f * m[i] - 0.8086757660f * s[i];
+            dst[x0 + i] = {toByte(L), toByte(A + A_OFFSET), toByte(B + B_OFFSET)};
+        }
+    }
+}
+
+} // namespace
+
+RGB rgbToOklab(RGB rgb)
+{
+    RGB lab;
+    rowToOklab(&rgb, &lab, 1);
+    return lab;
+}
+
+RGB oklabToRgb(RGB lab)
+{
+    float L = lab.r / SCALE;
+    float A = lab.g / SCALE - A_OFFSET;
+    float B = lab.b / SCALE - B_OFFSET;
+
+    float l = L + 0.3963377774f * A + 0.2158037573f * B;
+    float m = L - 0.1055613458f * A - 0.0638541728f * B;
+    float s = L - 0.0894841775f * A - 1.2914855480f * B;
+    l = l * l * l;
+    m = m * m * m;
+    s = s * s * s;
+
+    float r = +4.0767416621f * l - 3.3077115913f * m + 0.2309699292f * s;
+    float g = -1.2684380046f * l + 2.6097574011f * m - 0.3413193965f * s;
+    float b = -0.0041960863f * l - 0.7034186147f * m + 1.7076147010f * s;
+
+    auto toSrgb = [] (float c) {
+        return toByte(linearToSrgb(std::clamp(c, 0.0f, 1.0f)));
+    };
+    return {toSrgb(r), toSrgb(g), toSrgb(b)};
+}
+
+RgbMap rgbMapToOklab(RgbMap const &rgbmap, int nrThreads)
+{
+    auto labmap = RgbMap(rgbmap.width, rgbmap.height);
+
+    int nchunks = Parallel::chunkCount((long)rgbmap.width * rgbmap.height, nrThreads, 1 << 16);
+    Parallel::forChunks(rgbmap.height, nchunks, [&](int, int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            rowToOklab(rgbmap.row(y), labmap.row(y), rgbmap.width);
+        }
+    });
+    labmap.alpha = rgbmap.alpha;
+
+    return labmap;
+}
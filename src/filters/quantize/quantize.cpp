@@ -10,26 +10,65 @@
  * Released under GNU GPL v2+, read the file 'COPYING' for more information.
  */
 #include "filters/quantize/quantize.h"
+#include "filters/quantize/colorspace.h"
+#include "core/parallel/parallel.h"
+#include "core/cpu/kernels.h"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cmath>
+#include <numeric>
+#include <optional>
+#include <cstdint>
+#include <vector>
 
 
 
 namespace {
 
+using NodeId = std::uint32_t;
+
+NodeId constexpr NIL = ~NodeId(0);
+
+/**
+ * octree node topology: indices of the children
+ */
+struct OcLinks
+{
+    NodeId child[8];          // children, NIL if absent
+};
+
 /**
- * an octree node datastructure
+ * octree node descriptor
  */
-struct Ocnode
+struct OcInfo
 {
-    Ocnode *parent;           // parent node
-    Ocnode **ref;             // node's reference
-    Ocnode *child[8];         // children
-    int nchild;               // number of children
-    int width;                // width level of this node
     RGB rgb;                  // rgb's prefix of that node
-    unsigned long weight;     // number of pixels this node accounts for
-    unsigned long rs, gs, bs; // sum of pixels colors this node accounts for
+    std::uint8_t width;       // width level of this node
+    std::uint8_t nchild;      // number of children
     int nleaf;                // number of leaves under this node
-    unsigned long mi;         // minimum impact
+};
+
+/**
+ * sums of pixels colors a node accounts for
+ */
+struct OcSums
+{
+    unsigned long rs, gs, bs; // sum of pixels colors this node accounts for
+    unsigned long weight;     // number of pixels this node accounts for
+};
+
+/**
+ * an octree datastructure, nodes are stored as a structure of arrays
+ */
+struct Octree
+{
+    std::vector<OcLinks> links;
+    std::vector<OcInfo> info;
+    std::vector<OcSums> sums;
+    std::vector<unsigned long> mi; // minimum impact
+    std::vector<NodeId> freed;     // recycled slots
 };
 
 /*
@@ -133,8 +172,14 @@ struct Ocnode
 
 -- specific optimizations
 
-- pool allocation is used to allocate nodes (increased performance on large
-  images).
+- nodes live in an index-based octree: topology (32-bit child indices),
+  per-node info and color sums are kept in separate contiguous arrays, so
+  merge, prune and index passes touch far fewer cache lines than a pointer
+  based tree. freed slots are recycled through a free list.
+
+- there are no parent or back-reference links: the parent width needed for
+  minimal impact values is passed down the recursion, and the slot holding
+  a node is passed by reference.
 
 */
 
@@ -160,239 +205,231 @@ int childIndex(RGB rgb)
 /**
  * allocate a new node
  */
-Ocnode *ocnodeNew(Pool<Ocnode> &pool)
+NodeId ocnodeNew(Octree &tree)
 {
-    Ocnode *node = pool.draw();
-    node->ref = nullptr;
-    node->parent = nullptr;
-    node->nchild = 0;
-    for (auto &i : node->child) {
-        i = nullptr;
+    NodeId node;
+    if (!tree.freed.empty()) {
+        node = tree.freed.back();
+        tree.freed.pop_back();
+    } else {
+        node = tree.links.size();
+        tree.links.emplace_back();
+        tree.info.emplace_back();
+        tree.sums.emplace_back();
+        tree.mi.emplace_back();
     }
-    node->mi = 0;
+    for (auto &i : tree.links[node].child) {
+        i = NIL;
+    }
+    tree.info[node].nchild = 0;
+    tree.mi[node] = 0;
     return node;
 }
 
-void ocnodeFree(Pool<Ocnode> &pool, Ocnode *node)
-{
-    pool.drop(node);
-}
-
-/**
- * free a full octree
- */
-void octreeDelete(Pool<Ocnode> &pool, Ocnode *node)
+void ocnodeFree(Octree &tree, NodeId node)
 {
-    if (!node) return;
-    for (auto &i : node->child) {
-        octreeDelete(pool, i);
-    }
-    ocnodeFree(pool, node);
+    tree.freed.push_back(node);
 }
 
 /**
  *  pretty-print an octree, debugging purposes
  */
 #if 0
-void ocnodePrint(Ocnode *node, int indent)
+void ocnodePrint(Octree const &tree, NodeId node, int indent)
 {
-    if (!node) return;
+    if (node == NIL) return;
+    auto const &s = tree.sums[node];
     printf("width:%d weight:%lu rgb:%6x nleaf:%d mi:%lu\n",
-           node->width,
-           node->weight,
+           tree.info[node].width,
+           s.weight,
            (unsigned int)(
-           ((node->rs / node->weight) << 16) +
-           ((node->gs / node->weight) << 8) +
-           (node->bs / node->weight)),
-           node->nleaf,
-           node->mi
+           ((s.rs / s.weight) << 16) +
+           ((s.gs / s.weight) << 8) +
+           (s.bs / s.weight)),
+           tree.info[node].nleaf,
+           tree.mi[node]
            );
-    for (int i = 0; i < 8; i++) if (node->child[i])
+    for (int i = 0; i < 8; i++) if (tree.links[node].child[i] != NIL)
         {
         for (int k = 0; k < indent; k++) printf(" ");//indentation
-        printf("[%d:%p] ", i, node->child[i]);
-        ocnodePrint(node->child[i], indent+2);
+        printf("[%d:%u] ", i, tree.links[node].child[i]);
+        ocnodePrint(tree, tree.links[node].child[i], indent+2);
         }
 }
 
-void octreePrint(Ocnode *node)
+void octreePrint(Octree const &tree, NodeId node)
 {
     printf("<<octree>>\n");
-    if (node) printf("[r:%p] ", node); ocnodePrint(node, 2);
+    if (node != NIL) printf("[r:%u] ", node); ocnodePrint(tree, node, 2);
 }
 #endif
 
 /**
- * builds a single <rgb> color leaf at location <ref>
+ * builds a single <rgb> color leaf
  */
-void ocnodeLeaf(Pool<Ocnode> &pool, Ocnode **ref, RGB rgb)
-{
-    assert(ref);
-    Ocnode *node = ocnodeNew(pool);
-    node->width = 0;
-    node->rgb = rgb;
-    node->rs = rgb.r; node->gs = rgb.g; node->bs = rgb.b;
-    node->weight = 1;
-    node->nleaf = 1;
-    node->mi = 0;
-    node->ref = ref;
-    *ref = node;
+NodeId ocnodeLeaf(Octree &tree, RGB rgb)
+{
+    NodeId node = ocnodeNew(tree);
+    auto &info = tree.info[node];
+    info.width = 0;
+    info.rgb = rgb;
+    info.nleaf = 1;
+    tree.sums[node] = {rgb.r, rgb.g, rgb.b, 1};
+    return node;
 }
 
 /**
- *  merge nodes <node1> and <node2> at location <ref> with parent <parent>
+ *  merge nodes <node1> and <node2>, returns the resulting node
  */
-int octreeMerge(Pool<Ocnode> &pool, Ocnode *parent, Ocnode **ref, Ocnode *node1, Ocnode *node2)
+NodeId octreeMerge(Octree &tree, NodeId node1, NodeId node2)
 {
-    assert(ref);
-    if (!node1 && !node2) return 0;
+    if (node1 == NIL && node2 == NIL) return NIL;
     assert(node1 != node2);
-    if (parent && !*ref) parent->nchild++;
-    if (!node1) {
-        *ref = node2; node2->ref = ref; node2->parent = parent;
-        return node2->nleaf;
-    }
-    if (!node2) {
-        *ref = node1; node1->ref = ref; node1->parent = parent;
-        return node1->nleaf;
+    if (node1 == NIL) return node2;
+    if (node2 == NIL) return node1;
+    int dwitdth = tree.info[node1].width - tree.info[node2].width;
+    if (dwitdth < 0) {
+        // symmetric case, keep <node1> as the widest node
+        std::swap(node1, node2);
+        dwitdth = -dwitdth;
     }
-    int dwitdth = node1->width - node2->width;
-    if (dwitdth > 0 && node1->rgb == node2->rgb >> dwitdth) {
+    RGB rgb1 = tree.info[node1].rgb;
+    RGB rgb2 = tree.info[node2].rgb;
+    if (dwitdth > 0 && rgb1 == rgb2 >> dwitdth) {
         // place node2 below node1
-        *ref = node1; node1->ref = ref; node1->parent = parent;
-        int i = childIndex(node2->rgb >> (dwitdth - 1));
-        node1->rs += node2->rs; node1->gs += node2->gs; node1->bs += node2->bs;
-        node1->weight += node2->weight;
-        node1->mi = 0;
-        if (node1->child[i]) node1->nleaf -= node1->child[i]->nleaf;
-        node1->nleaf += octreeMerge(pool, node1, &node1->child[i], node1->child[i], node2);
-        return node1->nleaf;
-    } else if (dwitdth < 0 && node2->rgb == node1->rgb >> (-dwitdth)) {
-        // place node1 below node2
-        *ref = node2; node2->ref = ref; node2->parent = parent;
-        int i = childIndex(node1->rgb >> (-dwitdth - 1));
-        node2->rs += node1->rs; node2->gs += node1->gs; node2->bs += node1->bs;
-        node2->weight += node1->weight;
-        node2->mi = 0;
-        if (node2->child[i]) node2->nleaf -= node2->child[i]->nleaf;
-        node2->nleaf += octreeMerge(pool, node2, &node2->child[i], node2->child[i], node1);
-        return node2->nleaf;
+        int i = childIndex(rgb2 >> (dwitdth - 1));
+        auto &s1 = tree.sums[node1];
+        auto const &s2 = tree.sums[node2];
+        s1.rs += s2.rs; s1.gs += s2.gs; s1.bs += s2.bs;
+        s1.weight += s2.weight;
+        tree.mi[node1] = 0;
+        NodeId child = tree.links[node1].child[i];
+        if (child != NIL) {
+            tree.info[node1].nleaf -= tree.info[child].nleaf;
+        } else {
+            tree.info[node1].nchild++;
+        }
+        NodeId merged = octreeMerge(tree, child, node2);
+        tree.links[node1].child[i] = merged;
+        tree.info[node1].nleaf += tree.info[merged].nleaf;
+        return node1;
     } else {
         // nodes have either no intersection or the same root
-        Ocnode *newnode;
-        newnode = ocnodeNew(pool);
-        newnode->rs = node1->rs + node2->rs;
-        newnode->gs = node1->gs + node2->gs;
-        newnode->bs = node1->bs + node2->bs;
-        newnode->weight = node1->weight + node2->weight;
-        *ref = newnode; newnode->ref = ref; newnode->parent = parent;
-        if (dwitdth == 0 && node1->rgb == node2->rgb) {
+        NodeId newnode = ocnodeNew(tree);
+        auto const &s1 = tree.sums[node1];
+        auto const &s2 = tree.sums[node2];
+        tree.sums[newnode] = {s1.rs + s2.rs, s1.gs + s2.gs, s1.bs + s2.bs, s1.weight + s2.weight};
+        auto const info1 = tree.info[node1];
+        auto const info2 = tree.info[node2];
+        if (dwitdth == 0 && rgb1 == rgb2) {
             // merge the nodes in <newnode>
-            newnode->width = node1->width; // == node2->width
-            newnode->rgb = node1->rgb;     // == node2->rgb
-            newnode->nchild = 0;
-            newnode->nleaf = 0;
-            if (node1->nchild == 0 && node2->nchild == 0) {
-                newnode->nleaf = 1;
+            tree.info[newnode].width = info1.width; // == info2.width
+            tree.info[newnode].rgb = rgb1;          // == rgb2
+            int nleaf = 0;
+            if (info1.nchild == 0 && info2.nchild == 0) {
+                nleaf = 1;
             } else {
                 for (int i = 0; i < 8; i++) {
-                    if (node1->child[i] || node2->child[i]) {
-                        newnode->nleaf += octreeMerge(pool, newnode, &newnode->child[i], node1->child[i], node2->child[i]);
+                    NodeId c1 = tree.links[node1].child[i];
+                    NodeId c2 = tree.links[node2].child[i];
+                    if (c1 != NIL || c2 != NIL) {
+                        NodeId merged = octreeMerge(tree, c1, c2);
+                        tree.links[newnode].child[i] = merged;
+                        tree.info[newnode].nchild++;
+                        nleaf += tree.info[merged].nleaf;
                     }
                 }
             }
-            ocnodeFree(pool, node1); ocnodeFree(pool, node2);
-            return newnode->nleaf;
+            tree.info[newnode].nleaf = nleaf;
+            ocnodeFree(tree, node1); ocnodeFree(tree, node2);
+            return newnode;
         } else {
             // use <newnode> as a fork node with children <node1> and <node2>
-            int newwidth = std::max(node1->width, node2->width);
-            RGB rgb1 = node1->rgb >> (newwidth - node1->width);
-            RGB rgb2 = node2->rgb >> (newwidth - node2->width);
-            // according to the previous tests <rgb1> != <rgb2> before the loop
-            while (!(rgb1 == rgb2)) {
-                rgb1 = rgb1 >> 1;
-                rgb2 = rgb2 >> 1;
+            int newwidth = std::max(info1.width, info2.width);
+            RGB r1 = rgb1 >> (newwidth - info1.width);
+            RGB r2 = rgb2 >> (newwidth - info2.width);
+            // according to the previous tests <r1> != <r2> before the loop
+            while (!(r1 == r2)) {
+                r1 = r1 >> 1;
+                r2 = r2 >> 1;
                 newwidth++;
             }
-            newnode->width = newwidth;
-            newnode->rgb = rgb1; // == rgb2
-            newnode->nchild = 2;
-            newnode->nleaf = node1->nleaf + node2->nleaf;
-            int i1 = childIndex(node1->rgb >> (newwidth - node1->width - 1));
-            int i2 = childIndex(node2->rgb >> (newwidth - node2->width - 1));
-            node1->parent = newnode;
-            node1->ref = &newnode->child[i1];
-            newnode->child[i1] = node1;
-            node2->parent = newnode;
-            node2->ref = &newnode->child[i2];
-            newnode->child[i2] = node2;
-            return newnode->nleaf;
+            auto &info = tree.info[newnode];
+            info.width = newwidth;
+            info.rgb = r1; // == r2
+            info.nchild = 2;
+            info.nleaf = info1.nleaf + info2.nleaf;
+            int i1 = childIndex(rgb1 >> (newwidth - info1.width - 1));
+            int i2 = childIndex(rgb2 >> (newwidth - info2.width - 1));
+            tree.links[newnode].child[i1] = node1;
+            tree.links[newnode].child[i2] = node2;
+            return newnode;
         }
     }
 }
 
 /**
- * upatade mi value for leaves
+ * upatade mi value for leaves, <pwidth> is the parent width (-1 for the root)
  */
-void ocnodeMi(Ocnode *node)
+void ocnodeMi(Octree &tree, NodeId node, int pwidth)
 {
-    node->mi = node->parent ? node->weight << (2 * node->parent->width) : 0;
+    tree.mi[node] = pwidth >= 0 ? tree.sums[node].weight << (2 * pwidth) : 0;
 }
 
 /**
  * remove leaves whose prune impact value is lower than <lvl>. at most
  * <count> leaves are removed, and <count> is decreased on each removal.
  * all parameters including minimal impact values are regenerated.
+ * <ref> is the slot holding the node, <pwidth> the width of its parent.
  */
-void ocnodeStrip(Pool<Ocnode> &pool, Ocnode **ref, int &count, unsigned long lvl)
-{
-    Ocnode *node = *ref;
-    if (!node) return;
-    assert(ref == node->ref);
-    if (node->nchild == 0) { // leaf node
-        if (!node->mi) ocnodeMi(node); // mi generation may be required
-        if (node->mi > lvl) return; // leaf is above strip level
-        ocnodeFree(pool, node);
-        *ref = nullptr;
+void ocnodeStrip(Octree &tree, NodeId &ref, int pwidth, int &count, unsigned long lvl)
+{
+    NodeId node = ref;
+    if (node == NIL) return;
+    auto &info = tree.info[node];
+    auto &mi = tree.mi[node];
+    if (info.nchild == 0) { // leaf node
+        if (!mi) ocnodeMi(tree, node, pwidth); // mi generation may be required
+        if (mi > lvl) return; // leaf is above strip level
+        ocnodeFree(tree, node);
+        ref = NIL;
         count--;
     } else {
-        if (node->mi && node->mi > lvl) return; // node is above strip level
-        node->nchild = 0;
-        node->nleaf = 0;
-        node->mi = 0;
-        Ocnode **lonelychild = nullptr;
-        for (auto & i : node->child) {
-            if (i) {
-                ocnodeStrip(pool, &i, count, lvl);
-                if (i) {
+        if (mi && mi > lvl) return; // node is above strip level
+        info.nchild = 0;
+        info.nleaf = 0;
+        mi = 0;
+        NodeId *lonelychild = nullptr;
+        for (auto &i : tree.links[node].child) {
+            if (i != NIL) {
+                ocnodeStrip(tree, i, info.width, count, lvl);
+                if (i != NIL) {
                     lonelychild = &i;
-                    node->nchild++;
-                    node->nleaf += i->nleaf;
-                    if (!node->mi || node->mi > i->mi) {
-                        node->mi = i->mi;
+                    info.nchild++;
+                    info.nleaf += tree.info[i].nleaf;
+                    if (!mi || mi > tree.mi[i]) {
+                        mi = tree.mi[i];
                     }
                 }
             }
         }
         // tree adjustments
-        if (node->nchild == 0) {
+        if (info.nchild == 0) {
             count++;
-            node->nleaf = 1;
-            ocnodeMi(node);
-        } else if (node->nchild == 1) {
-            if ((*lonelychild)->nchild == 0) {
+            info.nleaf = 1;
+            ocnodeMi(tree, node, pwidth);
+        } else if (info.nchild == 1) {
+            if (tree.info[*lonelychild].nchild == 0) {
                 // remove the <lonelychild> leaf under a 1 child node
-                node->nchild = 0;
-                node->nleaf = 1;
-                ocnodeMi(node);
-                ocnodeFree(pool, *lonelychild);
-                *lonelychild = nullptr;
+                info.nchild = 0;
+                info.nleaf = 1;
+                ocnodeMi(tree, node, pwidth);
+                ocnodeFree(tree, *lonelychild);
+                *lonelychild = NIL;
             } else {
                 // make a bridge to <lonelychild> over a 1 child node
-                (*lonelychild)->parent = node->parent;
-                (*lonelychild)->ref = ref;
-                ocnodeFree(pool, node);
-                *ref = *lonelychild;
+                ref = *lonelychild;
+                ocnodeFree(tree, node);
             }
         }
     }
@@ -401,146 +438,656 @@ void ocnodeStrip(Pool<Ocnode> &pool, Ocnode **ref, int &count, unsigned long lvl
 /**
  * reduce the leaves of an octree to a given number
  */
-void octreePrune(Pool<Ocnode> &pool, Ocnode **ref, int ncolor)
+void octreePrune(Octree &tree, NodeId &root, int ncolor)
 {
-    assert(ref);
     assert(ncolor > 0);
-    int n = (*ref)->nleaf - ncolor;
-    if (!*ref || n <= 0) return;
+    if (root == NIL) return;
+    int n = tree.info[root].nleaf - ncolor;
     while (n > 0) {
-        ocnodeStrip(pool, ref, n, (*ref)->mi);
+        ocnodeStrip(tree, root, -1, n, tree.mi[root]);
     }
 }
 
 /**
  * build an octree associated to the area of a color map <rgbmap>,
- * included in the specified (x1,y1)--(x2,y2) rectangle.
+ * included in the specified (x1,y1)--(x2,y2) rectangle. fully transparent
+ * pixels add no leaf.
  */
-void octreeBuildArea(Pool<Ocnode> &pool, RgbMap const &rgbmap, Ocnode **ref, int x1, int y1, int x2, int y2, int ncolor)
+NodeId octreeBuildArea(Octree &tree, RgbMap const &rgbmap, int x1, int y1, int x2, int y2, int ncolor)
 {
     int dx = x2 - x1, dy = y2 - y1;
     int xm = x1 + dx / 2, ym = y1 + dy / 2;
-    Ocnode *ref1 = nullptr;
-    Ocnode *ref2 = nullptr;
     if (dx == 1 && dy == 1) {
-        ocnodeLeaf(pool, ref, rgbmap.getPixel(x1, y1));
+        if (rgbmap.isTransparent(x1, y1)) return NIL;
+        return ocnodeLeaf(tree, rgbmap.getPixel(x1, y1));
     } else if (dx > dy) {
-        octreeBuildArea(pool, rgbmap, &ref1, x1, y1, xm, y2, ncolor);
-        octreeBuildArea(pool, rgbmap, &ref2, xm, y1, x2, y2, ncolor);
-        octreeMerge(pool, nullptr, ref, ref1, ref2);
+        NodeId ref1 = octreeBuildArea(tree, rgbmap, x1, y1, xm, y2, ncolor);
+        NodeId ref2 = octreeBuildArea(tree, rgbmap, xm, y1, x2, y2, ncolor);
+        return octreeMerge(tree, ref1, ref2);
     } else {
-        octreeBuildArea(pool, rgbmap, &ref1, x1, y1, x2, ym, ncolor);
-        octreeBuildArea(pool, rgbmap, &ref2, x1, ym, x2, y2, ncolor);
-        octreeMerge(pool, nullptr, ref, ref1, ref2);
-	}
+        NodeId ref1 = octreeBuildArea(tree, rgbmap, x1, y1, x2, ym, ncolor);
+        NodeId ref2 = octreeBuildArea(tree, rgbmap, x1, ym, x2, y2, ncolor);
+        return octreeMerge(tree, ref1, ref2);
+    }
 
-    // octreePrune(ref, 2 * ncolor);
+    // octreePrune(tree, ref, 2 * ncolor);
     // affects result quality for almost same performance :/
 }
 
+/**
+ * copy the subtree at <node> of <tree> to <out> in depth-first order
+ */
+NodeId octreeCompactNode(Octree const &tree, NodeId node, Octree &out)
+{
+    NodeId id = out.links.size();
+    out.links.push_back(tree.links[node]);
+    out.info.push_back(tree.info[node]);
+    out.sums.push_back(tree.sums[node]);
+    out.mi.push_back(tree.mi[node]);
+    for (int i = 0; i < 8; i++) {
+        NodeId child = tree.links[node].child[i];
+        if (child != NIL) {
+            out.links[id].child[i] = octreeCompactNode(tree, child, out);
+        }
+    }
+    return id;
+}
+
+/**
+ * renumber the nodes of an octree in depth-first order, dropping the freed
+ * slots, so that the repeated pruning passes walk memory sequentially
+ */
+NodeId octreeCompact(Octree &tree, NodeId root)
+{
+    if (root == NIL) return NIL;
+    Octree out;
+    std::size_t nnodes = tree.links.size() - tree.freed.size();
+    out.links.reserve(nnodes);
+    out.info.reserve(nnodes);
+    out.sums.reserve(nnodes);
+    out.mi.reserve(nnodes);
+    root = octreeCompactNode(tree, root, out);
+    tree = std::move(out);
+    return root;
+}
+
 /**
  * build an octree associated to the <rgbmap> color map,
  * pruned to <ncolor> colors.
  */
-Ocnode *octreeBuild(Pool<Ocnode> &pool, RgbMap const &rgbmap, int ncolor)
+NodeId octreeBuild(Octree &tree, RgbMap const &rgbmap, int ncolor)
 {
     // create the octree
-    Ocnode *node = nullptr;
-    octreeBuildArea(pool,
-                    rgbmap, &node,
-                    0, 0, rgbmap.width, rgbmap.height, ncolor);
+    NodeId root = NIL;
+    if (rgbmap.width > 0 && rgbmap.height > 0) {
+        root = octreeBuildArea(tree, rgbmap,
+                               0, 0, rgbmap.width, rgbmap.height, ncolor);
+    }
 
     // prune the octree
-    octreePrune(pool, &node, ncolor);
+    root = octreeCompact(tree, root);
+    octreePrune(tree, root, ncolor);
 
-    return node;
+    return root;
 }
 
 /**
  * compute the color palette associated to an octree.
  */
-void octreeIndex(Ocnode *node, RGB *rgbpal, int &index)
+void octreeIndex(Octree const &tree, NodeId node, RGB *rgbpal, int &index)
 {
-    if (!node) return;
-    if (node->nchild == 0) {
-        rgbpal[index].r = node->rs / node->weight;
-        rgbpal[index].g = node->gs / node->weight;
-        rgbpal[index].b = node->bs / node->weight;
+    if (node == NIL) return;
+    if (tree.info[node].nchild == 0) {
+        auto const &s = tree.sums[node];
+        rgbpal[index].r = s.rs / s.weight;
+        rgbpal[index].g = s.gs / s.weight;
+        rgbpal[index].b = s.bs / s.weight;
         index++;
     } else {
-        for (auto &i : node->child) {
-            if (i) {
-                octreeIndex(i, rgbpal, index);
+        for (auto i : tree.links[node].child) {
+            if (i != NIL) {
+                octreeIndex(tree, i, rgbpal, index);
             }
         }
     }
 }
 
 /**
- * compute the squared distance between two colors
+ * palette of an octree pruned to <ncolor> leaves, returns its size
  */
-int distRGB(RGB rgb1, RGB rgb2)
+int octreePalette(RgbMap const &rgbmap, int ncolor, RGB *rgbpal)
 {
-    return (rgb1.r - rgb2.r) * (rgb1.r - rgb2.r)
-         + (rgb1.g - rgb2.g) * (rgb1.g - rgb2.g)
-         + (rgb1.b - rgb2.b) * (rgb1.b - rgb2.b);
+    Octree tree;
+    auto root = octreeBuild(tree, rgbmap, ncolor);
+
+    int index = 0;
+    octreeIndex(tree, root, rgbpal, index);
+    return index;
+}
+
+/*
+-- median cut:
+
+- colors are binned in a 32x32x32 histogram keeping the exact component sums
+  of every bin, boxes of that histogram are split along their longest side
+  at the weighted median until <ncolor> boxes exist or no box can be split.
+
+- the box to be split next is the one with the largest weight * side^2,
+  a rough estimate of the squared error it accounts for.
+*/
+
+int constexpr HBITS = 5;
+int constexpr HSIDE = 1 << HBITS;
+
+struct HistBin
+{
+    unsigned long weight, rs, gs, bs;
+};
+
+struct HistBox
+{
+    int lo[3], hi[3];     // inclusive bin bounds per component
+    unsigned long weight; // number of pixels inside the box
+    int side;             // longest side in component units
+    int axis;             // component of the longest side
+};
+
+int histIndex(int r, int g, int b)
+{
+    return (r << (2 * HBITS)) | (g << HBITS) | b;
 }
 
 /**
- * find the index of closest color in a palette
+ * shrink a box to the occupied bins it contains and update its statistics
  */
-int findRGB(RGB const *rgbs, int ncolor, RGB rgb)
+void histBoxShrink(std::vector<HistBin> const &hist, HistBox &box)
 {
-    int index = -1, dist = 0;
-    for (int k = 0; k < ncolor; k++) {
-        int d = distRGB(rgbs[k], rgb);
-        if (index == -1 || d < dist) { dist = d; index = k; }
+    int lo[3] = {HSIDE, HSIDE, HSIDE};
+    int hi[3] = {-1, -1, -1};
+    box.weight = 0;
+    for (int r = box.lo[0]; r <= box.hi[0]; r++) {
+        for (int g = box.lo[1]; g <= box.hi[1]; g++) {
+            for (int b = box.lo[2]; b <= box.hi[2]; b++) {
+                auto const &bin = hist[histIndex(r, g, b)];
+                if (!bin.weight) continue;
+                box.weight += bin.weight;
+                int c[3] = {r, g, b};
+                for (int k = 0; k < 3; k++) {
+                    lo[k] = std::min(lo[k], c[k]);
+                    hi[k] = std::max(hi[k], c[k]);
+                }
+            }
+        }
+    }
+    box.side = -1;
+    for (int k = 0; k < 3; k++) {
+        box.lo[k] = lo[k];
+        box.hi[k] = hi[k];
+        if (hi[k] - lo[k] > box.side) {
+            box.side = hi[k] - lo[k];
+            box.axis = k;
+        }
+    }
+}
+
+/**
+ * split <box> at the weighted median of its longest side, <box> keeps the
+ * lower half and the upper half is returned
+ */
+HistBox histBoxSplit(std::vector<HistBin> const &hist, HistBox &box)
+{
+    int const axis = box.axis;
+    unsigned long proj[HSIDE] = {};
+    for (int r = box.lo[0]; r <= box.hi[0]; r++) {
+        for (int g = box.lo[1]; g <= box.hi[1]; g++) {
+            for (int b = box.lo[2]; b <= box.hi[2]; b++) {
+                int c[3] = {r, g, b};
+                proj[c[axis]] += hist[histIndex(r, g, b)].weight;
+            }
+        }
+    }
+    int cut = box.lo[axis];
+    unsigned long acc = proj[cut];
+    while (cut < box.hi[axis] - 1 && 2 * acc < box.weight) {
+        acc += proj[++cut];
+    }
+
+    HistBox upper = box;
+    box.hi[axis] = cut;
+    upper.lo[axis] = cut + 1;
+    histBoxShrink(hist, box);
+    histBoxShrink(hist, upper);
+    return upper;
+}
+
+/**
+ * palette of the median cut of the color histogram of the pixels that are
+ * not fully transparent, returns its size
+ */
+int medianCutPalette(RgbMap const &rgbmap, int ncolor, RGB *rgbpal)
+{
+    std::vector<HistBin> hist(HSIDE * HSIDE * HSIDE, HistBin{0, 0, 0, 0});
+    for (int y = 0; y < rgbmap.height; y++) {
+        RGB const *row = rgbmap.row(y);
+        for (int x = 0; x < rgbmap.width; x++) {
+            if (rgbmap.isTransparent(x, y)) continue;
+            auto rgb = row[x];
+            auto &bin = hist[histIndex(rgb.r >> (8 - HBITS), rgb.g >> (8 - HBITS), rgb.b >> (8 - HBITS))];
+            bin.weight++;
+            bin.rs += rgb.r; bin.gs += rgb.g; bin.bs += rgb.b;
+        }
+    }
+
+    std::vector<HistBox> boxes;
+    boxes.push_back(HistBox{{0, 0, 0}, {HSIDE - 1, HSIDE - 1, HSIDE - 1}, 0, 0, 0});
+    histBoxShrink(hist, boxes[0]);
+    if (!boxes[0].weight) return 0;
+
+    while ((int)boxes.size() < ncolor) {
+        int best = -1;
+        unsigned long bestScore = 0;
+        for (int i = 0; i < (int)boxes.size(); i++) {
+            auto const &box = boxes[i];
+            if (box.side <= 0) continue;
+            unsigned long score = box.weight * box.side * box.side;
+            if (best == -1 || score > bestScore) {
+                best = i;
+                bestScore = score;
+            }
+        }
+        if (best == -1) break; // every box is a single bin
+        auto upper = histBoxSplit(hist, boxes[best]);
+        boxes.push_back(upper);
+    }
+
+    int index = 0;
+    for (auto const &box : boxes) {
+        HistBin sum{0, 0, 0, 0};
+        for (int r = box.lo[0]; r <= box.hi[0]; r++) {
+            for (int g = box.lo[1]; g <= box.hi[1]; g++) {
+                for (int b = box.lo[2]; b <= box.hi[2]; b++) {
+                    auto const &bin = hist[histIndex(r, g, b)];
+                    sum.weight += bin.weight;
+                    sum.rs += bin.rs; sum.gs += bin.gs; sum.bs += bin.bs;
+                }
+            }
+        }
+        rgbpal[index].r = sum.rs / sum.weight;
+        rgbpal[index].g = sum.gs / sum.weight;
+        rgbpal[index].b = sum.bs / sum.weight;
+        index++;
     }
     return index;
 }
 
-} // namespace
+/**
+ * a palette stored as separate component arrays, for batched distance
+ * computations
+ */
+struct Palette
+{
+    int size;
+    int r[256], g[256], b[256];
+
+    Palette(RGB const *rgbs, int n)
+        : size(n)
+    {
+        for (int k = 0; k < n; k++) {
+            r[k] = rgbs[k].r;
+            g[k] = rgbs[k].g;
+            b[k] = rgbs[k].b;
+        }
+    }
+};
+
+int constexpr BATCH = Kernels::COLOR_BATCH;
 
 /**
- * quantize an RGB image to a reduced number of colors.
+ * find the index of the closest palette color for a row of <width> pixels
  */
-IndexedMap rgbMapQuantize(RgbMap const &rgbmap, int ncolor)
+void findRGBRow(Palette const &pal, RGB const *rgbs, int width, unsigned *out)
 {
-    assert(ncolor > 0);
+    auto const nearestColor = Kernels::table().nearestColor;
+    for (int x = 0; x < width; x += BATCH) {
+        nearestColor(pal.r, pal.g, pal.b, pal.size, rgbs + x, std::min(BATCH, width - x), out + x);
+    }
+}
 
-    auto imap = IndexedMap(rgbmap.width, rgbmap.height);
+/**
+ * refine a palette with Lloyd (k-means) iterations over every <step>-th
+ * pixel of every <step>-th row, fully transparent ones left out. pixels
+ * are assigned in parallel, each chunk accumulating its own color sums.
+ */
+void kmeansRefine(RgbMap const &rgbmap, RGB *rgbpal, int ncolor, int iterations, int step, int nrThreads)
+{
+    step = std::max(step, 1);
+    int const nrows = (rgbmap.height + step - 1) / step;
+    int const ncols = (rgbmap.width + step - 1) / step;
+    int const nchunks = Parallel::chunkCount((long)nrows * ncols, nrThreads, 1 << 14);
+
+    std::vector<OcSums> sums(nchunks * ncolor);
+    for (int it = 0; it < iterations; it++) {
+        Palette pal(rgbpal, ncolor);
+        std::fill(sums.begin(), sums.end(), OcSums{0, 0, 0, 0});
+
+        Parallel::forChunks(nrows, nchunks, [&](int chunk, int begin, int end) {
+            OcSums *acc = sums.data() + chunk * ncolor;
+            std::vector<RGB> sample(ncols);
+            std::vector<unsigned> index(ncols);
+            for (int sy = begin; sy < end; sy++) {
+                RGB const *row = rgbmap.row(sy * step);
+                int n = 0;
+                for (int sx = 0; sx < ncols; sx++) {
+                    if (!rgbmap.isTransparent(sx * step, sy * step)) {
+                        sample[n++] = row[sx * step];
+                    }
+                }
+                findRGBRow(pal, sample.data(), n, index.data());
+                for (int sx = 0; sx < n; sx++) {
+                    auto &s = acc[index[sx]];
+                    s.rs += sample[sx].r; s.gs += sample[sx].g; s.bs += sample[sx].b;
+                    s.weight++;
+                }
+            }
+        });
+
+        bool moved = false;
+        for (int k = 0; k < ncolor; k++) {
+            OcSums total{0, 0, 0, 0};
+            for (int chunk = 0; chunk < nchunks; chunk++) {
+                auto const &s = sums[chunk * ncolor + k];
+                total.rs += s.rs; total.gs += s.gs; total.bs += s.bs;
+                total.weight += s.weight;
+            }
+            if (!total.weight) continue; // empty cluster keeps its color
+            RGB rgb;
+            rgb.r = (total.rs + total.weight / 2) / total.weight;
+            rgb.g = (total.gs + total.weight / 2) / total.weight;
+            rgb.b = (total.bs + total.weight / 2) / total.weight;
+            moved = moved || !(rgb == rgbpal[k]);
+            rgbpal[k] = rgb;
+        }
+        if (!moved) break;
+    }
+}
 
-    Pool<Ocnode> pool;
-    auto tree = octreeBuild(pool, rgbmap, ncolor);
+/**
+ * the first pixel of the <nx> x <ny> cell at (<x0>,<y0>) that is not fully
+ * transparent, scanning from its <start>-th pixel on and wrapping around.
+ * false when the whole cell is transparent.
+ */
+bool cellPixel(RgbMap const &rgbmap, int x0, int y0, int nx, int ny, int start, RGB &rgb)
+{
+    int const n = nx * ny;
+    for (int i = 0; i < n; i++) {
+        int const k = (start + i) % n;
+        int const x = x0 + k % nx, y = y0 + k / nx;
+        if (!rgbmap.isTransparent(x, y)) {
+            rgb = rgbmap.getPixel(x, y);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * reduce <rgbmap> to about <options.sampleBudget> pixels for palette
+ * construction, or nothing when the image is already small enough.
+ * the sample keeps an alpha plane when <rgbmap> has one, cells holding
+ * only fully transparent pixels are transparent in it.
+ */
+std::optional<RgbMap> paletteSample(RgbMap const &rgbmap, QuantizeOptions const &options)
+{
+    double pixels = (double)rgbmap.width * rgbmap.height;
+    int budget = std::max(options.sampleBudget, 1);
+    if (options.sampling == PaletteSampling::FULL || pixels <= budget) {
+        return {};
+    }
+
+    int const step = std::ceil(std::sqrt(pixels / budget));
+    int const width = (rgbmap.width + step - 1) / step;
+    int const height = (rgbmap.height + step - 1) / step;
+    auto sample = RgbMap(width, height);
+    if (rgbmap.hasAlpha()) {
+        sample.alpha.assign((size_t)width * height, 255);
+    }
+
+    for (int sy = 0; sy < height; sy++) {
+        int const y0 = sy * step;
+        int const ny = std::min(step, rgbmap.height - y0);
+        for (int sx = 0; sx < width; sx++) {
+            int const x0 = sx * step;
+            int const nx = std::min(step, rgbmap.width - x0);
+            RGB rgb{0, 0, 0};
+            bool found = true;
+            switch (options.sampling) {
+            case PaletteSampling::STRATIFIED: {
+                // cheap integer hash of the cell, stable from run to run
+                unsigned h = (unsigned)sx * 0x9e3779b1u ^ (unsigned)sy * 0x85ebca77u;
+                h ^= h >> 15; h *= 0x2c1b3c6du; h ^= h >> 12;
+                int const start = h % nx + (h >> 16) % ny * nx;
+                found = cellPixel(rgbmap, x0, y0, nx, ny, start, rgb);
+                break;
+            }
+            case PaletteSampling::MIPMAP: {
+                unsigned long rs = 0, gs = 0, bs = 0, n = 0;
+                for (int y = y0; y < y0 + ny; y++) {
+                    RGB const *row = rgbmap.row(y);
+                    for (int x = x0; x < x0 + nx; x++) {
+                        if (rgbmap.isTransparent(x, y)) continue;
+                        rs += row[x].r; gs += row[x].g; bs += row[x].b;
+                        n++;
+                    }
+                }
+                found = n > 0;
+                if (found) {
+                    rgb.r = (rs + n / 2) / n;
+                    rgb.g = (gs + n / 2) / n;
+                    rgb.b = (bs + n / 2) / n;
+                }
+                break;
+            }
+            case PaletteSampling::STRIDED:
+            default:
+                found = cellPixel(rgbmap, x0, y0, nx, ny, ny / 2 * nx + nx / 2, rgb);
+                break;
+            }
+            sample.setPixel(sx, sy, rgb);
+            if (!found) {
+                sample.alpha[sample.offset(sx, sy)] = 0;
+            }
+        }
+    }
+
+    return sample;
+}
+
+/**
+ * Build a palette of up to ncolor entries for the working space image
+ * <work>. Fills the sRGB colors, darkest first, into <table> and their
+ * working space values into <rgbs>; returns the palette size. Fully
+ * transparent pixels take no part.
+ */
+int buildPalette(RgbMap const &work, int ncolor, QuantizeOptions const &options,
+                 RGB *rgbs, bool oklab, ColorTable &table)
+{
+    // the palette may be estimated from a reduced image
+    auto sample = paletteSample(work, options);
+    RgbMap const &source = sample ? *sample : work;
 
-    auto rgbs = std::make_unique<RGB[]>(ncolor);
     int index = 0;
-    octreeIndex(tree, rgbs.get(), index);
+    switch (options.method) {
+    case QuantizeMethod::MEDIAN_CUT:
+        index = medianCutPalette(source, ncolor, rgbs);
+        break;
+    case QuantizeMethod::OCTREE:
+    default:
+        index = octreePalette(source, ncolor, rgbs);
+        break;
+    }
 
-    octreeDelete(pool, tree);
+    if (options.refineIterations > 0 && index > 0) {
+        kmeansRefine(source, rgbs, index, options.refineIterations,
+                     options.refineSampleStep, options.nrThreads);
+    }
+
+    // pair every working space color with its sRGB value
+    std::vector<std::pair<RGB, RGB>> colors(index);
+    for (int i = 0; i < index; i++) {
+        colors[i] = {oklab ? oklabToRgb(rgbs[i]) : rgbs[i], rgbs[i]};
+    }
 
     // stacking with increasing contrasts
-    std::sort(rgbs.get(), rgbs.get() + ncolor, [] (auto &ra, auto &rb) {
+    std::sort(colors.begin(), colors.end(), [] (auto &ca, auto &cb) {
+        auto &ra = ca.first, &rb = cb.first;
         return (ra.r + ra.g + ra.b) < (rb.r + rb.g + rb.b);
     });
 
-    // make the new map
     // fill in the color lookup table
     for (int i = 0; i < index; i++) {
-        imap.clut[i] = rgbs[i];
+        table.clut[i] = colors[i].first;
+        rgbs[i] = colors[i].second;
     }
-    imap.nrColors = index;
+    table.nrColors = index;
 
-    // fill in new map pixels
-    for (int y = 0; y < rgbmap.height; y++) {
-        for (int x = 0; x < rgbmap.width; x++) {
-            auto rgb = rgbmap.getPixel(x, y);
-            int index = findRGB(rgbs.get(), ncolor, rgb);
-            imap.setPixel(x, y, index);
+    return index;
+}
+
+} // namespace
+
+/**
+ * quantize an RGB image, handing rows of palette indices to <sink>.
+ */
+ColorTable rgbMapQuantize(RgbMap const &rgbmap, int ncolor, IndexRowSink &sink, QuantizeOptions const &options)
+{
+    assert(ncolor > 0);
+
+    ColorTable table;
+    ncolor = std::min<int>(ncolor, table.clut.size());
+
+    // palettes are built and pixels matched in the working color space
+    std::optional<RgbMap> labmap;
+    if (options.space == QuantizeSpace::OKLAB) {
+        labmap = rgbMapToOklab(rgbmap, options.nrThreads);
+    }
+    RgbMap const &work = labmap ? *labmap : rgbmap;
+
+    auto rgbs = std::make_unique<RGB[]>(table.clut.size());
+    int index = 0;
+
+    if (options.palette) {
+        // a given palette is used as is: same colors, same order
+        table = *options.palette;
+        index = table.nrColors;
+        for (int i = 0; i < index; i++) {
+            rgbs[i] = labmap ? rgbToOklab(table.clut[i]) : table.clut[i];
         }
+    } else {
+        index = buildPalette(work, ncolor, options, rgbs.get(), labmap.has_value(), table);
     }
 
-    return imap;
-}
+    sink.begin(rgbmap.width, rgbmap.height, index);
+    if (index == 0) {
+        return table;
+    }
+
+    // map the pixels, one row at a time
+    Palette pal(rgbs.get(), index);
+    bool const meanColors = labmap && !options.palette;
+    int nchunks = Parallel::chunkCount((long)work.width * work.height, options.nrThreads, 1 << 16);
+    std::vector<OcSums> sums(meanColors ? nchunks * index : 0, OcSums{0, 0, 0, 0});
+    // mean colors may reorder the palette, so their rows are held back
+    // until every pixel is matched
+    std::vector<unsigned char, MapAllocator<unsigned char>> held(
+        meanColors ? (size_t)work.width * work.height : 0);
+    Parallel::forChunks(work.height, nchunks, [&](int chunk, int begin, int end) {
+        std::vector<unsigned> indices(work.width);
+        for (int y = begin; y < end; y++) {
+            findRGBRow(pal, work.row(y), work.width, indices.data());
+            if (!meanColors) {
+                sink.row(y, indices.data());
+                continue;
+            }
+            // sum the sRGB pixels of every entry
+            OcSums *acc = sums.data() + chunk * index;
+            RGB const *row = rgbmap.row(y);
+            for (int x = 0; x < rgbmap.width; x++) {
+                if (rgbmap.isTransparent(x, y)) {
+                    continue;
+                }
+                auto &s = acc[indices[x]];
+                s.rs += row[x].r; s.gs += row[x].g; s.bs += row[x].b;
+                s.weight++;
+            }
+            std::copy(indices.begin(), indices.end(), held.data() + (size_t)y * work.width);
+        }
+    });
+
+    // 8 bit Oklab centroids lose precision near the gamut boundary, so
+    // the color table uses the exact sRGB mean of the matched pixels
+    if (meanColors) {
+        for (int k = 0; k < index; k++) {
+            OcSums total{0, 0, 0, 0};
+            for (int chunk = 0; chunk < nchunks; chunk++) {
+                auto const &s = sums[chunk * index + k];
+                total.rs += s.rs; total.gs += s.gs; total.bs += s.bs;
+                total.weight += s.weight;
+            }
+            if (!total.weight) continue;
+            table.clut[k].r = (total.rs + total.weight / 2) / total.weight;
+            table.clut[k].g = (total.gs + total.weight / 2) / total.weight;
+            table.clut[k].b = (total.bs + total.weight / 2) / total.weight;
+        }
+
+        // the means can differ in brightness order from the Oklab estimates
+        // the palette was sorted by; sort again for stacking
+        std::vector<int> order(index);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            auto const &ra = table.clut[a], &rb = table.clut[b];
+            return (ra.r + ra.g + ra.b) < (rb.r + rb.g + rb.b);
+        });
+        auto const clut = table.clut;
+        std::array<unsigned, 256> rank;
+        for (int i = 0; i < index; i++) {
+            table.clut[i] = clut[order[i]];
+            rank[order[i]] = i;
+        }
+
+        Parallel::forChunks(work.height, nchunks, [&](int, int begin, int end) {
+            std::vector<unsigned> indices(work.width);
+            for (int y = begin; y < end; y++) {
+                auto row = held.data() + (size_t)y * work.width;
+                for (int x = 0; x < work.width; x++) {
+                    indices[x] = rank[row[x]];
+                }
+                sink.row(y, indices.data());
+            }
+        });
+    }
 
+    return table;
+}
+/**
+ * quantize an RGB image to a reduced number of colors.
+ */
+IndexedMap rgbMapQuantize(RgbMap const &rgbmap, int ncolor, QuantizeOptions const &options)
+{
+    struct MapSink : IndexRowSink
+    {
+        IndexedMap &imap;
+        explicit MapSink(IndexedMap &imap) : imap(imap) {}
+        void begin(int, int, int) override {}
+        void row(int y, unsigned const *indices) override
+        {
+            std::copy(indices, indices + imap.width, imap.row(y));
+        }
+    };
 
+    auto imap = IndexedMap(rgbmap.width, rgbmap.height);
+    MapSink sink(imap);
+    auto table = rgbMapQuantize(rgbmap, ncolor, sink, options);
+    imap.clut = table.clut;
+    imap.nrColors = table.nrColors;
+    return imap;
+}
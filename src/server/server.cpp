@@ -0,0 +1,626 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/** @file
+ * Long-running local trace server on a Unix domain socket.
+ *//*
+ * Authors: see git history
+ *
+ * Released under GNU GPL v2+, read the file 'COPYING' for more information.
+ */
+#include "server/server.h"
+#include "server/protocol.h"
+#include "core/parallel/parallel.h"
+#include "core/parallel/queue.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace Server {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// 单个请求的像素上限
+uint64_t constexpr MAX_PIXELS = 1ull << 28;
+// 每行末尾填充的上限
+int64_t constexpr MAX_ROW_PADDING = 4096;
+// 同时服务的连接数上限
+size_t constexpr MAX_CONNECTIONS = 256;
+// 缓存的引擎数 (所有工作线程共享)
+size_t constexpr MAX_ENGINES = 8;
+
+std::atomic<bool> stopRequested{false};
+
+extern "C" void onSignal(int) { stopRequested = true; }
+
+long long micros(Clock::duration d) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+bool writeFull(int fd, void const *data, size_t size) {
+  auto p = static_cast<char const *>(data);
+  while (size > 0) {
+    auto n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool readFull(int fd, void *data, size_t size) {
+  auto p = static_cast<char *>(data);
+  while (size > 0) {
+    auto n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * Read <size> bytes at <offset> of a descriptor. False when it ends first.
+ */
+bool preadFull(int fd, void *data, size_t size, uint64_t offset) {
+  auto p = static_cast<char *>(data);
+  while (size > 0) {
+    auto n = pread(fd, p, size, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+/**
+ * Read a request header, along with the descriptor passed with it, if any.
+ */
+bool readHeader(int fd, RequestHeader &header, int &passedFd) {
+  passedFd = -1;
+  auto p = reinterpret_cast<char *>(&header);
+  size_t size = sizeof(header);
+  while (size > 0) {
+    iovec iov{p, size};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    auto n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      if (passedFd >= 0) {
+        close(passedFd);
+      }
+      return false;
+    }
+    for (auto c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+      if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+        int received;
+        std::memcpy(&received, CMSG_DATA(c), sizeof(int));
+        if (passedFd >= 0) {
+          close(passedFd);
+        }
+        passedFd = received;
+      }
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+int bytesPerPixel(int format) {
+  switch (format) {
+  case INK_PIXEL_RGB:
+  case INK_PIXEL_BGR:
+    return 3;
+  case INK_PIXEL_RGBA:
+  case INK_PIXEL_BGRA:
+    return 4;
+  case INK_PIXEL_GRAY:
+    return 1;
+  }
+  return 0;
+}
+
+// 可复用的像素缓冲区
+class BufferPool {
+public:
+  explicit BufferPool(size_t maxFree) : maxFree(maxFree) {}
+
+  std::vector<unsigned char> acquire(size_t size) {
+    std::vector<unsigned char> buffer;
+    {
+      std::lock_guard lock(mutex);
+      if (!free.empty()) {
+        buffer = std::move(free.back());
+        free.pop_back();
+      }
+    }
+    buffer.resize(size);
+    return buffer;
+  }
+
+  void release(std::vector<unsigned char> buffer) {
+    std::lock_guard lock(mutex);
+    if (free.size() < maxFree) {
+      free.push_back(std::move(buffer));
+    }
+  }
+
+private:
+  size_t const maxFree;
+  std::mutex mutex;
+  std::vector<std::vector<unsigned char>> free;
+};
+
+// 映射到内存的描述符内容
+struct Mapping {
+  void *base = MAP_FAILED;
+  size_t size = 0;
+  unsigned char const *pixels = nullptr;
+
+  Mapping() = default;
+  Mapping(Mapping const &) = delete;
+  Mapping &operator=(Mapping const &) = delete;
+  ~Mapping() {
+    if (base != MAP_FAILED) {
+      munmap(base, size);
+    }
+  }
+};
+
+// 延迟直方图: 每 2 倍分 4 档
+class LatencyHistogram {
+public:
+  void add(long long us) {
+    int bucket = std::min<int>(4 * std::log2(us + 1.0), BUCKETS - 1);
+    std::lock_guard lock(mutex);
+    counts[bucket]++;
+    total++;
+  }
+
+  // 分位数的上界 (微秒)
+  long long percentile(double p) {
+    std::lock_guard lock(mutex);
+    long long seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+      seen += counts[i];
+      if (seen > 0 && seen >= p * total) {
+        return std::exp2((i + 1) / 4.0);
+      }
+    }
+    return 0;
+  }
+
+  long long count() {
+    std::lock_guard lock(mutex);
+    return total;
+  }
+
+private:
+  static int constexpr BUCKETS = 128;
+  std::mutex mutex;
+  std::array<long long, BUCKETS> counts{};
+  long long total = 0;
+};
+
+// 响应
+struct Response {
+  ResponseHeader header{};
+  std::string payload;
+};
+
+Response errorResponse(ResponseStatus status, std::string message) {
+  Response response;
+  response.header.status = status;
+  response.payload = std::move(message);
+  return response;
+}
+
+// 排队中的请求
+struct Request {
+  RequestHeader header;
+  std::vector<unsigned char> inlinePixels;
+  std::unique_ptr<Mapping> mapping;
+  Clock::time_point received;
+  std::promise<Response> reply;
+
+  unsigned char const *pixels() const {
+    return mapping ? mapping->pixels : inlinePixels.data();
+  }
+};
+
+// 引擎缓存键
+std::string paramsKey(ink_params const &p) {
+  char key[512];
+  std::snprintf(key, sizeof(key), "%d %d %d %.17g %.17g %.17g %d %d %d %d %d %.17g %d %.17g %d",
+                p.trace_type, p.invert, p.quantization_colors,
+                p.brightness_threshold, p.brightness_floor, p.canny_threshold,
+                p.multiscan_colors, p.multiscan_stack, p.multiscan_smooth,
+                p.multiscan_remove_background, p.turdsize, p.alphamax,
+                p.opticurve, p.opttolerance, p.threads);
+  return key;
+}
+
+/**
+ * Engines by parameters, shared by all workers. Tracing never modifies an
+ * engine, so only the lookup is locked. A full cache drops its least
+ * recently used engine, which lives on until its traces finish.
+ */
+class EngineCache {
+public:
+  // 取得或构造引擎 (失败返回空)
+  std::shared_ptr<ink_engine> get(ink_params const &params) {
+    auto key = paramsKey(params);
+    std::lock_guard lock(mutex);
+    auto found = engines.find(key);
+    if (found != engines.end()) {
+      found->second.lastUse = ++uses;
+      return found->second.engine;
+    }
+    std::shared_ptr<ink_engine> engine(ink_engine_new(&params), ink_engine_free);
+    if (!engine) {
+      return nullptr;
+    }
+    if (engines.size() >= MAX_ENGINES) {
+      auto oldest = std::min_element(engines.begin(), engines.end(), [](auto &a, auto &b) {
+        return a.second.lastUse < b.second.lastUse;
+      });
+      engines.erase(oldest);
+    }
+    engines.emplace(key, Entry{engine, ++uses});
+    return engine;
+  }
+
+private:
+  struct Entry {
+    std::shared_ptr<ink_engine> engine;
+    uint64_t lastUse; // 最近一次取用的序号
+  };
+
+  std::mutex mutex;
+  std::map<std::string, Entry> engines;
+  uint64_t uses = 0;
+};
+
+/**
+ * Trace one request with an engine from the shared cache, using at most
+ * <maxThreads> threads whatever the client asked for.
+ */
+Response traceRequest(Request &request, EngineCache &engines, int maxThreads) {
+  auto const &header = request.header;
+
+  auto params = header.params;
+  params.threads = params.threads > 0 ? std::min(params.threads, maxThreads) : maxThreads;
+  auto engine = engines.get(params);
+  if (!engine) {
+    return errorResponse(STATUS_BAD_REQUEST, ink_last_error());
+  }
+
+  std::unique_ptr<ink_result, decltype(&ink_result_free)> result(
+      ink_trace(engine.get(), request.pixels(), header.width,
+                header.height, header.stride,
+                static_cast<ink_pixel_format>(header.format)),
+      ink_result_free);
+  if (!result) {
+    return errorResponse(STATUS_TRACE_FAILED, ink_last_error());
+  }
+
+  Response response;
+  response.header.itemCount = ink_result_count(result.get());
+  if (header.flags & REQUEST_SVG) {
+    response.payload = ink_result_svg(result.get());
+    return response;
+  }
+  auto append = [&](char const *text) {
+    uint32_t length = std::strlen(text);
+    response.payload.append(reinterpret_cast<char const *>(&length), sizeof(length));
+    response.payload.append(text, length);
+  };
+  for (size_t i = 0; i < response.header.itemCount; i++) {
+    append(ink_result_style(result.get(), i));
+    append(ink_result_path(result.get(), i));
+  }
+  return response;
+}
+
+/**
+ * Check a request header and get hold of its pixels. Returns an error
+ * message, empty on success.
+ */
+std::string loadPixels(int fd, int passedFd, Request &request, BufferPool &pool) {
+  auto const &header = request.header;
+  if (header.magic != REQUEST_MAGIC || header.version != PROTOCOL_VERSION) {
+    return "bad magic or protocol version";
+  }
+  int const bpp = bytesPerPixel(header.format);
+  if (bpp == 0) {
+    return "unknown pixel format";
+  }
+  if (header.width <= 0 || header.height <= 0 ||
+      (uint64_t)header.width * header.height > MAX_PIXELS ||
+      header.stride < (int64_t)header.width * bpp ||
+      header.stride > (int64_t)header.width * bpp + MAX_ROW_PADDING) {
+    return "bad image size or stride";
+  }
+  uint64_t const needed =
+      (uint64_t)header.stride * (header.height - 1) + (uint64_t)header.width * bpp;
+  if (needed > MAX_PIXELS * 4 + (uint64_t)MAX_ROW_PADDING * header.height) {
+    return "bad image size or stride";
+  }
+
+  if (header.flags & REQUEST_PIXELS_FD) {
+    if (passedFd < 0) {
+      return "no descriptor passed";
+    }
+    struct stat st;
+    if (fstat(passedFd, &st) != 0 || (uint64_t)st.st_size < needed ||
+        header.fdOffset > (uint64_t)st.st_size - needed) {
+      return "descriptor too small";
+    }
+    // 客户端仍可截短未封住的描述符, 映射后再读会触发 SIGBUS, 只好复制
+    int const seals = fcntl(passedFd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+      request.inlinePixels = pool.acquire(needed);
+      if (!preadFull(passedFd, request.inlinePixels.data(), needed, header.fdOffset)) {
+        return "descriptor too small";
+      }
+      return {};
+    }
+    // mmap 的偏移须按页对齐
+    uint64_t const page = sysconf(_SC_PAGESIZE);
+    uint64_t const start = header.fdOffset / page * page;
+    auto mapping = std::make_unique<Mapping>();
+    mapping->size = header.fdOffset - start + needed;
+    mapping->base = mmap(nullptr, mapping->size, PROT_READ, MAP_SHARED, passedFd, start);
+    if (mapping->base == MAP_FAILED) {
+      return "cannot map descriptor";
+    }
+    mapping->pixels = static_cast<unsigned char const *>(mapping->base) + (header.fdOffset - start);
+    request.mapping = std::move(mapping);
+    return {};
+  }
+
+  if (header.payloadSize != needed) {
+    return "payload size does not match the image";
+  }
+  request.inlinePixels = pool.acquire(needed);
+  if (!readFull(fd, request.inlinePixels.data(), needed)) {
+    return "connection closed";
+  }
+  return {};
+}
+
+} // namespace
+
+int serve(ServerOptions const &options) {
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (listener < 0 || options.socketPath.size() >= sizeof(address.sun_path)) {
+    std::fprintf(stderr, "ink: cannot create socket %s\n", options.socketPath.c_str());
+    return 1;
+  }
+  std::strcpy(address.sun_path, options.socketPath.c_str());
+  unlink(options.socketPath.c_str());
+  if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+      listen(listener, 64) != 0) {
+    std::fprintf(stderr, "ink: cannot listen on %s: %s\n", options.socketPath.c_str(),
+                 std::strerror(errno));
+    close(listener);
+    return 1;
+  }
+
+  struct sigaction action{};
+  action.sa_handler = onSignal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  int const nrWorkers = Parallel::threadCount(options.workers);
+  // 各追踪线程平分处理器核
+  int const threadsPerTrace = std::max(1, Parallel::threadCount(0) / nrWorkers);
+  Parallel::BoundedQueue<std::shared_ptr<Request>> queue(options.queueDepth);
+  BufferPool pool(options.queueDepth + nrWorkers);
+  LatencyHistogram queueLatency, traceLatency, totalLatency;
+
+  // 追踪线程: 共享热引擎
+  EngineCache engines;
+  std::vector<std::thread> workers;
+  for (int i = 0; i < nrWorkers; i++) {
+    workers.emplace_back([&] {
+      while (auto item = queue.pop()) {
+        auto &request = **item;
+        auto started = Clock::now();
+        Response response;
+        try {
+          response = traceRequest(request, engines, threadsPerTrace);
+        } catch (std::exception const &e) {
+          response = errorResponse(STATUS_TRACE_FAILED, e.what());
+        }
+        auto finished = Clock::now();
+
+        response.header.queueMicros = micros(started - request.received);
+        response.header.traceMicros = micros(finished - started);
+        queueLatency.add(response.header.queueMicros);
+        traceLatency.add(response.header.traceMicros);
+        totalLatency.add(micros(finished - request.received));
+        if (options.verbose) {
+          std::fprintf(stderr, "ink: %dx%d queued %lld us, traced %lld us\n",
+                       request.header.width, request.header.height,
+                       (long long)response.header.queueMicros,
+                       (long long)response.header.traceMicros);
+        }
+
+        if (request.inlinePixels.capacity()) {
+          pool.release(std::move(request.inlinePixels));
+        }
+        request.mapping.reset();
+        request.reply.set_value(std::move(response));
+      }
+    });
+  }
+
+  // 连接线程: 读请求, 排队, 按序回复
+  std::mutex connectionsMutex;
+  std::condition_variable connectionsDone;
+  std::set<int> connections;
+
+  auto sendResponse = [](int fd, Response &response) {
+    response.header.magic = RESPONSE_MAGIC;
+    response.header.payloadSize = response.payload.size();
+    return writeFull(fd, &response.header, sizeof(response.header)) &&
+           writeFull(fd, response.payload.data(), response.payload.size());
+  };
+
+  auto serveRequests = [&](int fd) {
+    for (;;) {
+      auto request = std::make_shared<Request>();
+      int passedFd;
+      if (!readHeader(fd, request->header, passedFd)) {
+        break;
+      }
+      request->received = Clock::now();
+      std::string error;
+      try {
+        error = loadPixels(fd, passedFd, *request, pool);
+      } catch (std::exception const &e) {
+        error = e.what();
+      }
+      if (passedFd >= 0) {
+        close(passedFd);
+      }
+
+      Response response;
+      if (!error.empty()) {
+        response = errorResponse(STATUS_BAD_REQUEST, error);
+      } else {
+        auto reply = request->reply.get_future();
+        if (!queue.push(request)) {
+          break;
+        }
+        response = reply.get();
+      }
+
+      if (!sendResponse(fd, response)) {
+        break;
+      }
+      if (!error.empty()) {
+        break; // 请求可能未读完, 连接已失去同步
+      }
+    }
+  };
+
+  auto serveConnection = [&](int fd) {
+    // 异常只结束这一个连接
+    try {
+      serveRequests(fd);
+    } catch (std::exception const &e) {
+      auto response = errorResponse(STATUS_BAD_REQUEST, e.what());
+      sendResponse(fd, response);
+    }
+    std::lock_guard lock(connectionsMutex);
+    connections.erase(fd);
+    close(fd);
+    connectionsDone.notify_all();
+  };
+
+  while (!stopRequested) {
+    pollfd p{listener, POLLIN, 0};
+    if (poll(&p, 1, 200) <= 0) {
+      continue;
+    }
+    int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    {
+      std::lock_guard lock(connectionsMutex);
+      if (connections.size() >= MAX_CONNECTIONS) {
+        close(fd); // 客户端看到连接被关闭
+        continue;
+      }
+      connections.insert(fd);
+    }
+    try {
+      std::thread(serveConnection, fd).detach();
+    } catch (std::system_error const &) {
+      std::lock_guard lock(connectionsMutex);
+      connections.erase(fd);
+      close(fd);
+    }
+  }
+
+  // 关闭: 停止接收, 完成已排队的请求
+  close(listener);
+  unlink(options.socketPath.c_str());
+  {
+    std::unique_lock lock(connectionsMutex);
+    for (int fd : connections) {
+      shutdown(fd, SHUT_RD);
+    }
+    connectionsDone.wait(lock, [&] { return connections.empty(); });
+  }
+  queue.close();
+  for (auto &t : workers) {
+    t.join();
+  }
+
+  std::fprintf(stderr,
+               "ink: %lld requests; total p50 %lld us, p99 %lld us; "
+               "queue p99 %lld us; trace p50 %lld us, p99 %lld us\n",
+               totalLatency.count(), totalLatency.percentile(0.5),
+               totalLatency.percentile(0.99), queueLatency.percentile(0.99),
+               traceLatency.percentile(0.5), traceLatency.percentile(0.99));
+  return 0;
+}
+
+} // namespace Server
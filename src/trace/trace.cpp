@@ -18,7 +18,11 @@
 
 
 #include <cassert>
+#include <cctype>
+#include <charconv>
+#include <chrono>
 #include <fstream>
+#include <iomanip>
 #include <sstream>
 #include <locale>
 
@@ -31,6 +35,133 @@ TraceResult trace(std::unique_ptr<TracingEngine> engine,
   return engine->trace(rgbmap);
 }
 
+void TracingEngine::traceStream(RgbMap const &rgbmap,
+                                TraceItemSink const &sink) const {
+  auto result = trace(rgbmap);
+  for (auto &item : result.items) {
+    sink(std::move(item));
+  }
+}
+
+RgbMap TracingEngine::previewScaled(RgbPyramid &pyramid,
+                                    PreviewBudget const &budget) const {
+  int level = budget.minPixels > 0 ? pyramid.levelFor(budget.minPixels) : 0;
+  double const nanosPerPixel = previewNanosPerPixel;
+  if (budget.maxMillis > 0 && nanosPerPixel > 0) {
+    while (level + 1 < pyramid.levelCount() &&
+           pyramid.levelPixels(level) * nanosPerPixel >
+               budget.maxMillis * 1e6) {
+      level++;
+    }
+  }
+
+  auto const &rgbmap = pyramid.level(level);
+  auto start = std::chrono::steady_clock::now();
+  auto result = preview(rgbmap);
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  if (rgbmap.width > 0 && rgbmap.height > 0) {
+    previewNanosPerPixel =
+        elapsed.count() / ((double)rgbmap.width * rgbmap.height);
+  }
+  return result;
+}
+
+TraceResult TracingEngine::traceProgressive(RgbMap const &rgbmap,
+                                            TraceCallback const &onResult,
+                                            ProgressiveOptions const &options) const {
+  if (auto coarse = rgbMapReduce(rgbmap, options.coarsePixels)) {
+    auto preview = trace(*coarse);
+    onResult(scaleTraceResult(preview, (double)rgbmap.width / coarse->width,
+                              (double)rgbmap.height / coarse->height),
+             false);
+  }
+
+  auto result = trace(rgbmap);
+  onResult(result, true);
+  return result;
+}
+
+namespace {
+
+// 缩放并平移路径数据中的全部坐标 (相对坐标只缩放)
+std::string transformPathData(std::string const &pathData, double sx,
+                              double sy, double dx, double dy) {
+  std::ostringstream out;
+  out.imbue(std::locale::classic());
+  out << std::fixed << std::setprecision(2);
+
+  char command = 0;
+  int axis = 0;
+  char const *p = pathData.data();
+  char const *end = p + pathData.size();
+  while (p < end) {
+    if (std::isalpha((unsigned char)*p)) {
+      command = *p;
+      axis = 0;
+      out << *p++;
+      continue;
+    }
+    double value;
+    auto [next, ec] = std::from_chars(p, end, value);
+    if (ec != std::errc()) {
+      out << *p++;
+      continue;
+    }
+    bool horizontal;
+    if (command == 'H' || command == 'h') {
+      horizontal = true;
+    } else if (command == 'V' || command == 'v') {
+      horizontal = false;
+    } else {
+      horizontal = axis++ % 2 == 0;
+    }
+    double const offset =
+        std::isupper((unsigned char)command) ? (horizontal ? dx : dy) : 0.0;
+    out << value * (horizontal ? sx : sy) + offset;
+    p = next;
+  }
+
+  return out.str();
+}
+
+// 缩放样式中的线宽
+std::string scaleStyle(std::string const &style, double scale) {
+  std::string const key = "stroke-width:";
+  auto pos = style.find(key);
+  if (pos == std::string::npos) {
+    return style;
+  }
+  pos += key.size();
+  double width;
+  auto [next, ec] =
+      std::from_chars(style.data() + pos, style.data() + style.size(), width);
+  if (ec != std::errc()) {
+    return style;
+  }
+  std::ostringstream out;
+  out.imbue(std::locale::classic());
+  out << style.substr(0, pos) << width * scale
+      << style.substr(next - style.data());
+  return out.str();
+}
+
+} // namespace
+
+TraceResult scaleTraceResult(TraceResult const &result, double sx, double sy) {
+  TraceResult scaled;
+  for (auto const &item : result.items) {
+    scaled.items.emplace_back(scaleStyle(item.style, (sx + sy) / 2),
+                              transformPathData(item.pathData, sx, sy, 0, 0));
+  }
+  return scaled;
+}
+
+TraceResultItem translateTraceItem(TraceResultItem const &item, double dx,
+                                   double dy) {
+  return {item.style, transformPathData(item.pathData, 1, 1, dx, dy)};
+}
+
 // TraceResult
 
 std::string TraceResult::toSvg(int width, int height) const {